@@ -1,26 +1,54 @@
 /* Find small drifters against a stable background.   3/20/97 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "dr.h"
 
 #define COUNT   0   /* If true, then periodically print how often */
                     /* various functions are called.              */
+#define THREADS 1   /* If true, allow the search to be split among */
+                    /* several threads (T command).  Needs pthreads. */
+
+#if THREADS
+#include <pthread.h>
+#define THREADLOCAL __thread    /* Each search thread has its own copy */
+#else
+#define THREADLOCAL
+#endif
 
 /************************************************************************/
 /* These control how big things can be.                                 */
 /************************************************************************/
 
-#define MAXHT       81      /* Height and width of space */
-#define MAXWD       81
-int HT = MAXHT;             /* May be reduced by user */
-int WD = MAXWD;
+#define MAXHT       1024    /* Max height and width of space (the grids */
+#define MAXWD       1024    /* are allocated for the HT and WD in use)  */
+#define MINHT       5       /* Min height and width of space: a cell */
+#define MINWD       5       /* inside the 2-cell OFF boundary        */
+#define DEFHT       81      /* Default height and width of space */
+#define DEFWD       81
+#define LINESIZE    64      /* Grid rows are padded to a multiple of this */
 
 #define MAXGEN      500     /* Max generation that can be computed */
 #define CHGLISTLTH  100000  /* Max total number of changed cells and    */
                             /* their neighbors in all gens            */
-#define HASHTBLSIZE 2000000 /* Max number of distinct life histories */
+#define HASHTBLSIZE 65536   /* Initial size of hash table of life      */
+                            /* histories (a power of 2); it doubles    */
+                            /* whenever it gets half full              */
 #define MAXKNOWN    7500    /* Max number of known rotors */
+#define KNOWNHASHSIZE 16384 /* Size of hash index of known rotors (a power */
+                            /* of 2, at least twice MAXKNOWN)              */
 #define MAXFILESIZE 1500000 /* Max length of known rotor descriptors & names */
 #define NUMVARS     200     /* # of vars available for program modification */
+#define MAXCHECKS   30      /* Max number of constraints in a pipeline */
 #define MAXROTORDESCLTH	1000	/* Max length of rotor descriptors */
 
 /************************************************************************/
@@ -34,6 +62,15 @@ typedef char boolean;
 #define OK      FALSE   /* Return values for functions */
 #define ERR     TRUE
 
+#define FLIPPED 2       /* Value of setting.free for a free choice whose */
+                        /* alternative has already been taken            */
+
+/* How trycell picks the cell and value for a free choice (branch command) */
+enum {FIRSTCELL, CONSTRAINEDCELL, PROBECELL};
+enum {RANDOMVALUE, LEASTVALUE};
+char *branchcellname[] = {"first", "constrained", "probe", NULL};
+char *branchvaluename[] = {"random", "least", NULL};
+
 /* Values of elements of bkgd, curr, cell */
 #define OFF 0
 #define ON  1
@@ -53,45 +90,37 @@ typedef char boolean;
 #define XSYMM       6
 #define FULLSYMM    7
 #define VERTSYMM    8
-int SYMM = NOSYMM;
 
-#define err(msg)        { printf("\n\n%s\n",msg); exit(1); }
-#define err1(msg,arg)   { printf("\n\n"); printf(msg,arg); printf("\n"); \
-                          exit(1); }
-#define err2(msg,arg0,arg1) { printf("\n\n"); printf(msg,arg0,arg1); \
-                              printf("\n"); exit(1); }
+#define err(msg)        { fprintf(errfile(), "\n\n%s\n",msg); fail(); }
+#define err1(msg,arg)   { fprintf(errfile(), "\n\n"); \
+                          fprintf(errfile(), msg,arg); \
+                          fprintf(errfile(), "\n"); fail(); }
+#define err2(msg,arg0,arg1) { fprintf(errfile(), "\n\n"); \
+                              fprintf(errfile(), msg,arg0,arg1); \
+                              fprintf(errfile(), "\n"); fail(); }
+FILE *errfile(void);        /* See below, after the searchstate type */
+void fail(void);
 
 #define min(x,y)    ((x)<(y) ? (x) : (y))
 #define max(x,y)    ((x)<(y) ? (y) : (x))
 #define diff(a,b)   ((a)<(b) ? (b)-(a) : (a)-(b))
 
-#if COUNT       /* Variables used to count function calls */
+#if COUNT
 int TRACE = 0;
-long int countsetbkgd, countconsistify, countconsis9, countproceed,
-         countbackup, countgo, countlistneighbors, countchangecurr,
-         countnxgen, counttrycell;
 #endif
-long int countcomporbackuplo,     /* Up to 10^6 */
-         countcomporbackuphi;     /* Always do this one */
-
-boolean SKIPSTABLE = FALSE; /* If true, don't display stable outcomes */
-boolean NOPICS = FALSE;     /* If true, don't show pictures */
-boolean SKIPFIZZLE = FALSE; /* If true, don't display fizzle outcomes */
-boolean SHOWFIN = FALSE;    /* If true, display finished patterns */
-boolean SHOWALL = FALSE;    /* If true, display all gens */
-
-char knownrotorsfilename[100] = "knownrotors";
 
 /************************************************************************/
-/* These are the arrays that contain information about the rule.        */
+/* These are the arrays that contain information about the rule.  They  */
+/* never change once they've been computed, so all searches using the   */
+/* same rule share one copy, kept on the list ruletables.               */
 /************************************************************************/
 
-boolean rule[2][9] = {{0,0,0,1,0,0,0,0,0},  /* Birth & survival rules */
-                      {0,0,1,1,0,0,0,0,0}};
-
-/* -------------------------------------------------------------------- */
-
-char transtable[2][129];
+typedef struct ruletable
+  { struct ruletable *link;
+    boolean rule[2][9];             /* Birth & survival rules */
+    char transtable[2][129];
+    char consistable[UNK+1][129];
+  }  ruletable;
 
 /* If val is the value of a cell in the current generation (OFF or ON)
    and nbhd is the sum of the values of the 8 surrounding cells (each of
@@ -103,9 +132,6 @@ char transtable[2][129];
 
 enum {NOINFO = 0, INCONSIS, NAYSOFF, NAYSON, CELLOFF, CELLON};
 
-char consistable[UNK+1][129];
-char oldconsistable[UNK+1][129];
-
 /* If val is the value of a background cell (OFF, ON, or UNK) and
    nbhd is the sum of the values of the 8 surrounding cells, then
    consistable[val][nbhd] is:
@@ -116,7 +142,7 @@ char oldconsistable[UNK+1][129];
    CELLOFF  if the cell is UNK and must be OFF;
    CELLON   if the cell is UNK and must be ON;
    NOINFO   if nothing is forced.
-   
+
    Note that for some rules and values of val and nbhd, it's possible
    for both the cell and its neighbors to be forced.  For example, if
    the rule is B78/S8, val=UNK, oncount=7, offcount=0, and unkcount=1,
@@ -126,21 +152,53 @@ char oldconsistable[UNK+1][129];
    see if any neighbors are forced.
 */
 
-/************************************************************************/
-/* Here are the global variables used in the search.                    */
-/************************************************************************/
+ruletable *ruletables;      /* All rules used so far */
+
+/* -------------------------------------------------------------------- */
 
-unsigned char bkgd[MAXHT][MAXWD],       /* Each cell is ON, OFF, or UNK */
-              curr[MAXHT][MAXWD];
+typedef struct knownrotors
+  { struct knownrotors *link;
+    char filename[100];         /* File they were read from */
+    int numknown;               /* Number of known rotors */
+    char **rotor, **name;       /* Rotor descriptors and names of */
+                                /* oscillators (MAXKNOWN+1 each)  */
+    int *index;     /* index[j] is 1 + index in rotor of the first rotor */
+                    /* with some descriptor, or 0; see findknown()       */
+    char *text;     /* The descriptors and names, and index, if read */
+    int *indexbuf;  /* from a text file                              */
+    char *map;      /* The database file, if it was mapped instead */
+    long int maplth;
+  }  knownrotors;
+
+knownrotors *knownrotorlist;    /* All the files of known rotors read so */
+                                /* far, each read only once              */
+
+#define ROTORDBMAGIC "dr rotordb 2"
+#define ROTORDBORDER 0x01020304 /* Reads differently in another byte order */
+typedef struct
+  { char magic[16];
+    int byteorder, numknown, hashsize;
+    long int lth;               /* Length of the whole file */
+  }  rotordbheader;
+/* A known rotor database, made by the rotordb command, consists of the
+   header, knownindex, the offsets of the descriptors and of the names
+   (numknown ints each), and then the descriptors and names.
+*/
+
+#if THREADS
+pthread_mutex_t sharedlock = PTHREAD_MUTEX_INITIALIZER;
+                            /* Guards ruletables and knownrotorlist */
+#endif
 
-int	naysum[MAXHT][MAXWD];				/* Sum of 8 neighbors in bkgd */
+/************************************************************************/
+/* Here are the types used in the search.                               */
+/************************************************************************/
 
 #define DONTCHANGE  1
 #define DONTCOUNT   2
-unsigned char flag[MAXHT][MAXWD];
-/* Each bit is a flag controlling some aspect of the cell.  At the moment
-   only 2 are defined:
-   
+/* Each bit of flag[r][c] is a flag controlling some aspect of the cell.
+   At the moment only 2 are defined:
+
    Bit 0 = DONTCHANGE   If true, don't allow the cell to change.
    Bit 1 = DONTCOUNT    Don't count changes here in computing the size
                         of the changed region.
@@ -151,53 +209,246 @@ typedef struct
     int col;
   }  point;
 
-int gen,                /* Current generation number */
-    maxgenreached=0;    /* Largest generation computed */
-int maxchng=9;          /* Max # of changed cells in any generation */
-int maxwidth=3;         /* Max width of set of changed cells in any gen */
-int maxheight=3;        /* Max height of set of changed cells in any gen */
-int prob = 50;          /* 100*probability, used when freely setting cells */
-boolean found;
-point *nay,             /* Ptr into list of neighbors of previous gen */
-      *chg;             /* Ptr to end of list of changes in current gen */
-
-point chglist[CHGLISTLTH];  /* Concatenation of lists of changes and
-                               neighbors in all gens */
-point *(chgd[MAXGEN+1]),
-      *(nays[MAXGEN+1]);
-/* Ptrs into chglist:
-        chglist == chgd[0] < nays[0] < chgd[1] < nays[1] < ...
-   chgd[g] points to list of cells that differ from bkgd in gen g.
-   nays[g] points to list of neighbors of such.
-   chgd[g] is subset of nays[g-1].
-*/
-
-int chgcount[MAXGEN];	/* Number of changed cells in each gen */
-int agesm[MAXGEN];		/* Age sums.  Only computed if var[129] nonzero */
-int width[MAXGEN], height[MAXGEN];	/* Width and height of changed region */
+typedef struct
+  { unsigned short row, col;    /* Row 0 ends a list, since cells in it */
+  }  cellref;                   /* are never set                        */
 
-int numcc;					/* Required values of chgcount, specified by */
-int reqchgcount[MAXGEN];	/* 'cc' command, are in reqchgcount[0], ..., */
-							/* reqchgcount[numcc-1].                     */
+typedef struct
+  { short minr, maxr, minc, maxc;   /* Box around the changes */
+    short mindif, maxdif,           /* Range of row-col and row+col */
+          minsum, maxsum;
+    int count;                      /* Number of changes */
+  }  chgstats;
+/* The changes counted here are those in a gen up to some point in its
+   list, except those in DONTCOUNT cells.
+*/
 
 typedef struct
   { int row;
     int col;
     unsigned char val;
-    boolean free;
+    boolean free;       /* TRUE, FALSE (forced), or FLIPPED */
     int gen;
     point *nay;
     point *chg;
   }  setting;
 
-setting settinglist[MAXHT*MAXWD];       /* List of background cell settings */
+#define NGRAD   4   /* Radius of the window around a cell kept in a nogood */
+#define NGWAYS  4   /* Nogoods per bucket of the nogood store */
+#define NGCORE  0xfc003f000fc0UL    /* Bits of cells[1] for the 3x3 block */
+                                    /* in the middle of the window        */
+
+typedef struct
+  { unsigned long int cells[3], /* bkgd in the window around the cell, */
+                                /* 2 bits per cell, 3 rows per word    */
+                      mask[3];  /* Cells of the window that matter */
+    unsigned char val;          /* Value that was tried for the cell */
+    boolean inuse;
+    unsigned short saved;       /* Settings made before the contradiction */
+    unsigned long int lastuse;  /* For evicting the least recently used */
+  }  nogood;
+
+typedef struct
+  { unsigned long int lo, hi;   /* Two independent 64-bit hashes; */
+  }  fingerprint;               /* both 0 marks an empty slot     */
+
+typedef struct
+  { char *path;                 /* Free choices leading to the piece */
+    long int calls;             /* Calls needed to search it, if known */
+    boolean finished,           /* Searched completely while sampling */
+            splittable;         /* Has a free choice below its root */
+    int owner;                  /* Part of the split search it's in, */
+  }  splitpiece;                /* or -1 if it's shared by all parts */
+
+typedef struct workitem
+  { struct workitem *link;
+    int lth;                    /* Number of free choices in path */
+    char path[1];               /* Their values, in order */
+  }  workitem;
+
+typedef struct
+  { char *name;                 /* Command that sets it, or NULL */
+    int var, var2;              /* Its parameters are var[var], var[var2] */
+    boolean (*cellcheck)(int r, int c); /* Exactly one of these is set */
+    boolean (*gencheck)(void);
+    char *help;                 /* For listcommands */
+  }  constraint;
+/* A constraint is enabled if var[var] is nonzero.  A cellcheck is called
+   from trycell() for each changed cell (r,c) that's counted, and a
+   gencheck when a gen has been completed.  They return TRUE if the
+   search must back up.
+*/
+
+/************************************************************************/
+/* Here are the variables used in the search.  Everything that belongs  */
+/* to one search is kept in a searchstate, so that several searches can */
+/* be run in one process.  S points to the search that the current      */
+/* thread is working on.  When a search is split among several threads, */
+/* each thread has its own searchstate, and master points to the one    */
+/* they share (the hash table, the results, the output, and the list of */
+/* subtrees still to be searched).                                      */
+/************************************************************************/
 
-setting *nxstng,        /* Pointer to setting whose consequences are
+struct searchstate
+  { /* Parameters, set by commands */
+    int HT, WD;                 /* Height and width of space */
+    int SYMM;
+    boolean SKIPSTABLE;         /* If true, don't display stable outcomes */
+    boolean NOPICS;             /* If true, don't show pictures */
+    boolean SKIPFIZZLE;         /* If true, don't display fizzle outcomes */
+    boolean SHOWFIN;            /* If true, display finished patterns */
+    boolean SHOWALL;            /* If true, display all gens */
+    boolean CANONHASH;          /* If true, results that differ only by */
+                                /* a translation or symmetry are dups   */
+    boolean LOOKAHEAD;          /* If true, check the cells still to be */
+                                /* computed after each setting          */
+    long int nogoodsize;        /* Size of nogood store, or 0 for none */
+    int maxchng;        /* Max # of changed cells in any generation */
+    int maxwidth;       /* Max width of set of changed cells in any gen */
+    int maxheight;      /* Max height of set of changed cells in any gen */
+    int prob;           /* 100*probability, used when freely setting cells */
+    int numcc;                  /* Required values of chgcount, specified */
+    int reqchgcount[MAXGEN];    /* by 'cc' command, are in reqchgcount[0], */
+                                /* ..., reqchgcount[numcc-1].              */
+    long int var[NUMVARS];  /* Variables available for program modifications */
+    boolean (*cellchecks[MAXCHECKS+1])(int r, int c);   /* Enabled */
+    boolean (*genchecks[MAXCHECKS+1])(void);    /* constraints, NULL- */
+                                                /* terminated         */
+    unsigned char **flag;               /* DONTCHANGE, DONTCOUNT */
+    cellref (**orbit)[8];               /* Other cells set with each cell, */
+    boolean orbitflip;                  /* to the opposite value if this   */
+                                        /* is set.  Computed from SYMM.    */
+    ruletable *rules;
+    char knownrotorsfilename[100];
+    knownrotors *known;         /* Read from it when the search starts */
+    int numthreads;             /* Number of search threads (T command) */
+    FILE *out;                  /* Where messages and results are printed */
+    boolean keepresults;        /* If true, queue results for drnextresult */
+    char *patternsrc;           /* Pattern text for the read command, */
+                                /* or NULL to read standard input     */
+    char checkpointfile[100];   /* Set by checkpoint command */
+    long int checkpointcalls,   /* Checkpoint every this many million */
+             checkpointsecs;    /* calls and this many seconds        */
+    char resumefile[100];       /* Set by resume command */
+    int splitindex, splitcount, /* Set by split and frontier commands */
+        splitdepth;
+    long int samplecalls;       /* Calls per sample for split */
+    splitpiece *pieces;         /* Pieces of the search tree for split, */
+    int numpieces,              /* sorted by path                       */
+        piece,                  /* The piece we're in, and the depth of */
+        piecedepth;             /* its root, or INT_MAX if above them   */
+    boolean sampling;           /* Searching only to cut the tree */
+    int branchcell, branchvalue;    /* Set by branch command */
+
+    /* The search position.  The grids (HT x WD, indexed [r][c]) are
+       allocated by newgrids(). */
+    unsigned char **bkgd,               /* Each cell is ON, OFF, or UNK */
+                  **curr;
+    int **naysum;                       /* Sum of 8 neighbors in bkgd */
+    unsigned int **mark,                /* Used by listneighbors and */
+                 stamp,                 /* proceed to see which cells */
+                 stampbase;             /* they've looked at          */
+    unsigned long int **changedin;
+                        /* Bit g of changedin[r][c] is set if (r,c) is */
+                        /* in the list of changes in gen g, for g < 64 */
+    int gen;                    /* Current generation number */
+    boolean found;
+    point *nay,         /* Ptr into list of neighbors of previous gen */
+          *chg;         /* Ptr to end of list of changes in current gen */
+    point chglist[CHGLISTLTH];  /* Concatenation of lists of changes
+                                   and neighbors in all gens */
+    chgstats chgstat;   /* Stats of the changes in gen so far (from */
+                        /* chgd[gen] to chg-1), if there are any    */
+    chgstats *settingstat;      /* chgstat when each setting in */
+                                /* settinglist was made freely  */
+    point *(chgd[MAXGEN+1]),
+          *(nays[MAXGEN+1]);
+    int chgcount[MAXGEN];       /* Number of changed cells in each gen */
+    int agesm[MAXGEN];  /* Age sums.  Only computed if var[129] nonzero */
+    int width[MAXGEN], height[MAXGEN];  /* Width and height of changed
+                                           region */
+    setting *settinglist;       /* List of background cell settings */
+                                /* (HT*WD of them)                  */
+    cellref *forcedby;  /* For each setting made by consistify, the cell */
+                        /* whose neighborhood forced it                  */
+    cellref conflictat; /* Cell whose neighborhood was inconsistent */
+    unsigned char **cell;       /* Work grid for printoscinfo */
+    int startminr, startmaxr,   /* Bounding box of ON cells of bkgd */
+        startminc, startmaxc;   /* when the search started          */
+    setting *nxstng,    /* Pointer to setting whose consequences are
                            being examined */
-        *nwstng;        /* Pointer to setting that's being added to list */
+            *nwstng;    /* Pointer to setting that's being added to list */
+    int depth;          /* Number of free choices in settinglist */
+    char *forcedpath;   /* Values to use for the first forcedlth */
+    int forcedlth,      /* free choices, instead of random ones.  */
+        forcedpos;      /* Used to start a thread in a subtree.   */
+    unsigned long int next;     /* Random number generator state */
+    boolean started, finished;
+    boolean stopped;            /* Stopped by SIGTERM after checkpoint */
+    volatile boolean failed;    /* Stopped by an error */
+    jmp_buf *onerror;           /* Where err() goes back to when run  */
+                                /* from another program, or NULL      */
+    boolean checkpointdue;
+    time_t nextcheckpoint;
+
+    /* Counters */
+#if COUNT       /* Variables used to count function calls */
+    long int countsetbkgd, countconsistify, countconsis9, countproceed,
+             countbackup, countgo, countlistneighbors, countchangecurr,
+             countnxgen, counttrycell;
+#endif
+    long int countcomporbackuplo,   /* Up to 10^6 */
+             countcomporbackuphi,   /* Always do this one */
+             countreplay;   /* Calls spent replaying another */
+                            /* thread's choices; not counted */
+    long int countnodes;    /* Free choices made (not counting their */
+                            /* alternatives, or replayed ones)       */
+    boolean newmillion;     /* Set when countcomporbackuphi changes */
+    nogood *nogoods;        /* Contradictions found by proceed (each */
+                            /* thread has its own store)             */
+    unsigned long int nogoodclock;
+    long int nogoodlearned, nogoodhits, /* Nogoods stored, nogoods used, */
+             nogoodsaved;               /* and settings they saved       */
+    int genseen;            /* Largest maxgenreached this thread has */
+                            /* seen; only above it can it set a new one */
+    char rotordesc[MAXROTORDESCLTH];    /* Last rotor descriptor and */
+    char *rotorname;                    /* name printed              */
+
+    /* Shared by all threads of the search; only used in master */
+    struct searchstate *master;
+    int maxgenreached;          /* Largest generation computed (guarded */
+                                /* by worklock)                         */
+    fingerprint *hashtable;     /* Open addressing, linear probing */
+    long int hashsize,          /* Number of slots */
+             hashcount,         /* Number of them in use */
+             hashlookups,       /* Calls of hashnew, and slots */
+             hashprobes;        /* looked at by them           */
+    drresult *results,          /* Results not yet returned by */
+             **lastresult;      /* drnextresult                */
+    drresult *returned;         /* Last result returned */
+#if THREADS
+    pthread_mutex_t hashlock;   /* Guards hashtable */
+    workitem *worklist;         /* Subtrees not yet being searched */
+    int busythreads;            /* Number of threads searching a subtree */
+    volatile int idlethreads;   /* Number of threads waiting for work */
+    long int numsubtrees;       /* Number of subtrees handed out */
+    long int totalcomporbackup, /* Sums of all threads' counts */
+             totalreplay, totalnodes,
+             totallearned, totalhits, totalsaved;
+    pthread_mutex_t worklock;
+    pthread_cond_t workcond;
+#endif
+  };
 
-long int var[NUMVARS];  /* Variables available for program modifications */
-/* Currently defined:
+/* Ptrs into chglist:
+        chglist == chgd[0] < nays[0] < chgd[1] < nays[1] < ...
+   chgd[g] points to list of cells that differ from bkgd in gen g.
+   nays[g] points to list of neighbors of such.
+   chgd[g] is subset of nays[g-1].
+*/
+
+/* Currently defined values of var.  Those that turn on a constraint can
+   also be set by name; see constraints[].
    var[100]   If nonzero (>= 2), only require change count <= maxchng at
 			  least once in every var[100] consecutive gens.
    var[101]   If nonzero, bound on # of cells that are changed this gen
@@ -258,9 +509,26 @@ long int var[NUMVARS];  /* Variables available for program modifications */
    var[139]   If nonzero, bound on number of neighbors of changed cells.
 */
 
-char knownrotorsandnames[MAXFILESIZE];
-char *knownrotor[MAXKNOWN], *name[MAXKNOWN];
-    /* Rotor descriptors and names of oscillators read from "knownrotors" */
+THREADLOCAL searchstate *S;     /* The search this thread is working on */
+
+/* -------------------------------------------------------------------- */
+
+FILE *errfile(void) /* fcn */
+/* Return the file that error messages are printed on. */
+{ return S && S->out ? S->out : stdout;
+}
+
+/* -------------------------------------------------------------------- */
+
+void fail(void) /* fcn */
+/* Give up after an error, whose message has been printed.  When the
+   search is run from another program (see dr.h), go back to drcommand,
+   drrun or drstep, which return -1; otherwise exit.
+*/
+{ fflush(errfile());
+  if (S && S->onerror)  longjmp(*S->onerror, 1);
+  exit(1);
+}
 
 /************************************************************************/
 /*  For portability, I'm defining rand and srand as in Kernighan &      */
@@ -268,15 +536,13 @@ char *knownrotor[MAXKNOWN], *name[MAXKNOWN];
 /*  those in 'standard' libraries.                                      */
 /************************************************************************/
 
-unsigned long int next=1;
-
 int KRrand(void)    /* fcn */
-{   next=next*1103515245 + 12345;
-    return (unsigned int)(next/65536) % 32768;
+{   S->next=S->next*1103515245 + 12345;
+    return (unsigned int)(S->next/65536) % 32768;
 }
 
 void KRsrand(unsigned int seed) /* fcn */
-{   next=seed;
+{   S->next=seed;
 }
 
 int myrandom(int n) /* fcn */
@@ -284,100 +550,218 @@ int myrandom(int n) /* fcn */
 {   return KRrand()%n;
 }
 
+/************************************************************************/
+/* The grids are allocated for the current HT and WD, as vectors of row */
+/* pointers, with each row padded to whole cache lines.                 */
+/************************************************************************/
+
+long int rowbytes(searchstate *s, int size)    /* fcn */
+/* Return the length of a grid row of elements of the given size: WD of
+   them, padded to whole cache lines.
+*/
+{ return ((long int) s->WD*size + LINESIZE-1) / LINESIZE * LINESIZE;
+}
+
+#define gridbytes(s,grid)   ((s)->HT * rowbytes(s, sizeof(**(grid))))
+                            /* Total length of the rows of grid */
+
+/* -------------------------------------------------------------------- */
+
+void *allocgrid(searchstate *s, int size)   /* fcn */
+/* Allocate an HT x WD grid of elements of the given size, cleared to 0,
+   and return its vector of row pointers.  The rows follow the vector in
+   the same block, so the grid is freed by free(grid), and its cells are
+   the gridbytes() bytes starting at grid[0].
+*/
+{ char **grid, *p;
+  long int head, row;
+  int r;
+
+  head = ((long int) s->HT*sizeof(char *) + LINESIZE-1) / LINESIZE * LINESIZE;
+  row = rowbytes(s, size);
+  if (posix_memalign((void **) &grid, LINESIZE, head + s->HT*row))
+    err("Out of memory in allocgrid()");
+  memset((char *) grid + head, 0, s->HT*row);
+  for (r=0, p=(char *) grid+head; r<s->HT; r++, p+=row)  grid[r] = p;
+  return grid;
+}
+
+#define newgrid(s,grid)     ((grid) = allocgrid(s, sizeof(**(grid))))
+
+/* -------------------------------------------------------------------- */
+
+void newgrids(searchstate *s, boolean shared)   /* fcn */
+/* Allocate the grids and the setting list of s for its HT and WD.  The
+   flag and orbit grids don't change during the search, so the threads
+   of a search use the master's; they're only allocated if shared is TRUE.
+*/
+{ newgrid(s, s->bkgd);
+  newgrid(s, s->curr);
+  newgrid(s, s->naysum);
+  newgrid(s, s->mark);
+  newgrid(s, s->changedin);
+  newgrid(s, s->cell);
+  s->stamp = 0;
+  if (!(s->settinglist = malloc(s->HT*s->WD*sizeof(setting))) ||
+      !(s->settingstat = malloc(s->HT*s->WD*sizeof(chgstats))) ||
+      !(s->forcedby = malloc(s->HT*s->WD*sizeof(cellref))))
+    err("Out of memory in newgrids()");
+  if (shared)
+    { newgrid(s, s->flag);
+      newgrid(s, s->orbit);
+    }
+}
+
+/* -------------------------------------------------------------------- */
+
+void freegrids(searchstate *s, boolean shared)  /* fcn */
+/* Free what newgrids(s, shared) allocated */
+{ free(s->bkgd);
+  free(s->curr);
+  free(s->naysum);
+  free(s->mark);
+  free(s->changedin);
+  free(s->cell);
+  free(s->settinglist);
+  free(s->settingstat);
+  free(s->forcedby);
+  if (shared)
+    { free(s->flag);
+      free(s->orbit);
+    }
+}
+
+/* -------------------------------------------------------------------- */
+
 /************************************************************************/
 /* The following functions deal primarily with making the background    */
 /* stable.  However, they also change curr[r][c] whenever they change   */
 /* bkgd[r][c].                                                          */
 /************************************************************************/
 
+void addorbit(int r, int c, int r1, int c1)   /* fcn */
+/* Add (r1,c1) to the symmetry orbit of (r,c), unless it's already there
+   or is off the edge (which can only happen if HT != WD for a symmetry
+   that needs them equal; beginsearch will complain about that).
+*/
+{ cellref *o;
+
+  if (r1 == r && c1 == c && !S->orbitflip)  return;
+  if (r1 < 1 || r1 >= S->HT-1 || c1 < 1 || c1 >= S->WD-1)  return;
+  for (o=S->orbit[r][c]; o->row; o++)
+    if (o->row == r1 && o->col == c1)  return;
+  o->row = r1;  o->col = c1;
+}
+
+/* -------------------------------------------------------------------- */
+
+void initorbits(void)   /* fcn */
+/* Compute the symmetry orbit of each cell for setbkgd: the other cells
+   that must be set whenever it is.  Each is listed once, so cells on a
+   line of symmetry don't get duplicate settings.  The exception is Day/
+   Night symmetry (var[130]), where a cell that's its own image is still
+   set again, to the opposite value, as it always has been.
+*/
+{ int r, c, h, w;
+
+  h = S->HT-1;  w = S->WD-1;
+  S->orbitflip = S->var[130] &&
+    (S->SYMM==HORSYMM || S->SYMM==VERTSYMM || S->SYMM==ROT180SYMM);
+  memset(S->orbit[0], 0, gridbytes(S, S->orbit));
+
+  for (r=1; r<h; r++)
+    for (c=1; c<w; c++)
+      switch(S->SYMM)
+        { case NOSYMM:
+            break;
+
+          case HORSYMM:
+            if (c >= S->var[114])  /* If var[114]==0, this applies to all c */
+              addorbit(r,c, h-r,c);
+            break;
+
+          case VERTSYMM:
+            if (r >= S->var[115])
+              addorbit(r,c, r,w-c);
+            break;
+
+          case DIAGSYMM:
+            addorbit(r,c, c,r);
+            break;
+
+          case ROT90SYMM:       /* Must have HT = WD */
+            addorbit(r,c, h-c,r);
+            addorbit(r,c, h-r,h-c);
+            addorbit(r,c, c,h-r);
+            break;
+
+          case ROT180SYMM:
+            addorbit(r,c, h-r,w-c);
+            break;
+
+          case PLUSSYMM:
+            addorbit(r,c, h-r,c);
+            addorbit(r,c, h-r,w-c);
+            addorbit(r,c, r,w-c);
+            break;
+
+          case XSYMM:           /* Must have HT = WD */
+            addorbit(r,c, c,r);
+            addorbit(r,c, h-r,h-c);
+            addorbit(r,c, h-c,h-r);
+            break;
+
+          case FULLSYMM:        /* Must have HT = WD */
+            addorbit(r,c, r,h-c);
+            addorbit(r,c, h-r,c);
+            addorbit(r,c, h-r,h-c);
+            addorbit(r,c, c,r);
+            addorbit(r,c, c,h-r);
+            addorbit(r,c, h-c,r);
+            addorbit(r,c, h-c,h-r);
+            break;
+
+          default:
+            err("Bad symmetry type");
+        }
+}
+
+/* -------------------------------------------------------------------- */
+
 #define set(r0,c0) \
-  inc = v - bkgd[r0][c0]; \
-  bkgd[nwstng->row = (r0)][nwstng->col = (c0)] = curr[r0][c0] = \
-											   nwstng->val = v; \
-  naysum[(r0)-1][(c0)-1] += inc; \
-  naysum[(r0)-1][(c0)  ] += inc; \
-  naysum[(r0)-1][(c0)+1] += inc; \
-  naysum[(r0)  ][(c0)-1] += inc; \
-  naysum[(r0)  ][(c0)+1] += inc; \
-  naysum[(r0)+1][(c0)-1] += inc; \
-  naysum[(r0)+1][(c0)  ] += inc; \
-  naysum[(r0)+1][(c0)+1] += inc;
+  inc = v - S->bkgd[r0][c0]; \
+  S->bkgd[S->nwstng->row = (r0)][S->nwstng->col = (c0)] = S->curr[r0][c0] = \
+											   S->nwstng->val = v; \
+  S->naysum[(r0)-1][(c0)-1] += inc; \
+  S->naysum[(r0)-1][(c0)  ] += inc; \
+  S->naysum[(r0)-1][(c0)+1] += inc; \
+  S->naysum[(r0)  ][(c0)-1] += inc; \
+  S->naysum[(r0)  ][(c0)+1] += inc; \
+  S->naysum[(r0)+1][(c0)-1] += inc; \
+  S->naysum[(r0)+1][(c0)  ] += inc; \
+  S->naysum[(r0)+1][(c0)+1] += inc;
 
 void setbkgd(int r, int c, unsigned char v, boolean f)  /* fcn */
 /* Set bkgd[r,c] to v and store choice at nwstng.
 */
-{ static int inc;
+{ int inc;
+  cellref *o;
 #if COUNT
-  countsetbkgd++;
+  S->countsetbkgd++;
 #endif
-  if (bkgd[r][c] != UNK || r==0 || r==HT-1 || c==0 || c==WD-1)
-    { printf("bkgd[%d,%d] = %d\n",r,c,bkgd[r][c]); 
+  if (S->bkgd[r][c] != UNK || r==0 || r==S->HT-1 || c==0 || c==S->WD-1)
+    { fprintf(S->out, "bkgd[%d,%d] = %d\n",r,c,S->bkgd[r][c]); 
       err("setbkgd error");
     }
 
   set(r,c)
-  (nwstng++)->free = f;
-
-  /* Note that if r=c and SYMM=DIAGSYMM, a duplicate setting will be   */
-  /* added to settinglist.  This won't cause any trouble; it will just */
-  /* cause backup to set the cell to UNK twice.  The same will happen  */
-  /* if r=HT-1-r and SYMM=HORSYMM, etc.                                */
-  switch(SYMM)
-    { case NOSYMM:
-        break;
-
-      case HORSYMM:
-		if (var[130])  v=1-v;
-		if (c >= var[114])		/* If var[114]==0, this applies to all c */
-		  { set(HT-1-r,c)			(nwstng++)->free = 0; }
-        break;
-
-      case VERTSYMM:
-		if (var[130])  v=1-v;
-		if (r >= var[115])
-		  { set(r,WD-1-c)			(nwstng++)->free = 0; }
-        break;
-        
-      case DIAGSYMM:
-		set(c,r)				(nwstng++)->free = 0;
-        break;
-
-      case ROT90SYMM:      	/* Must have HT = WD */
-		set(HT-1-c,r)			(nwstng++)->free = 0;
-		set(HT-1-r,HT-1-c)		(nwstng++)->free = 0;
-		set(c,HT-1-r)			(nwstng++)->free = 0;
-        break;
-
-      case ROT180SYMM:
-		if (var[130])  v=1-v;
-		set(HT-1-r,WD-1-c)		(nwstng++)->free = 0;
-        break;
-
-      case PLUSSYMM:
-		set(HT-1-r,c)			(nwstng++)->free = 0;
-		set(HT-1-r,WD-1-c)		(nwstng++)->free = 0;
-		set(r,WD-1-c)			(nwstng++)->free = 0;
-        break;
-
-      case XSYMM:           /* Must have HT = WD */
-		set(c,r)				(nwstng++)->free = 0;
-		set(HT-1-r,HT-1-c)		(nwstng++)->free = 0;
-		set(HT-1-c,HT-1-r)		(nwstng++)->free = 0;
-        break;
+  (S->nwstng++)->free = f;
+  if (f)  S->depth++;
 
-      case FULLSYMM:        /* Must have HT = WD */
-		set(r,HT-1-c)			(nwstng++)->free = 0;
-		set(HT-1-r,c)			(nwstng++)->free = 0;
-		set(HT-1-r,HT-1-c)		(nwstng++)->free = 0;
-		set(c,r)				(nwstng++)->free = 0;
-		set(c,HT-1-r)			(nwstng++)->free = 0;
-		set(HT-1-c,r)			(nwstng++)->free = 0;
-		set(HT-1-c,HT-1-r)		(nwstng++)->free = 0;
-        break;
-        
-      default:
-        err("Bad symmetry type");
-      }
+  /* Set the other cells in its symmetry orbit */
+  if (S->orbitflip)  v=1-v;
+  for (o=S->orbit[r][c]; o->row; o++)
+    { set(o->row,o->col)  (S->nwstng++)->free = 0; }
 
   return;
 }
@@ -390,15 +774,16 @@ char consistify(int r, int c)   /* fcn */
    setting at nwstng.
    Assumes that 0<r<HT-1 and 0<c<WD-1.
 */
-{ static int tablevalue;
+{ int tablevalue;
 
 #if COUNT
-  countconsistify++;
+  S->countconsistify++;
 #endif
 
 START:
 
-  if ((tablevalue = consistable[bkgd[r][c]][naysum[r][c]]) == NOINFO)
+  if ((tablevalue = S->rules->consistable[S->bkgd[r][c]][S->naysum[r][c]])
+                                                                    == NOINFO)
 	return OK;
         /* This is the most common case, so do it separately for speed */
 
@@ -407,25 +792,25 @@ START:
         return ERR;
 
       case NAYSOFF:
-        if (bkgd[r-1][c-1] == UNK)  setbkgd(r-1,c-1,OFF,0);
-        if (bkgd[r-1][c  ] == UNK)  setbkgd(r-1,c  ,OFF,0);
-        if (bkgd[r-1][c+1] == UNK)  setbkgd(r-1,c+1,OFF,0);
-        if (bkgd[r  ][c-1] == UNK)  setbkgd(r  ,c-1,OFF,0);
-        if (bkgd[r  ][c+1] == UNK)  setbkgd(r  ,c+1,OFF,0);
-        if (bkgd[r+1][c-1] == UNK)  setbkgd(r+1,c-1,OFF,0);
-        if (bkgd[r+1][c  ] == UNK)  setbkgd(r+1,c  ,OFF,0);
-        if (bkgd[r+1][c+1] == UNK)  setbkgd(r+1,c+1,OFF,0);
+        if (S->bkgd[r-1][c-1] == UNK)  setbkgd(r-1,c-1,OFF,0);
+        if (S->bkgd[r-1][c  ] == UNK)  setbkgd(r-1,c  ,OFF,0);
+        if (S->bkgd[r-1][c+1] == UNK)  setbkgd(r-1,c+1,OFF,0);
+        if (S->bkgd[r  ][c-1] == UNK)  setbkgd(r  ,c-1,OFF,0);
+        if (S->bkgd[r  ][c+1] == UNK)  setbkgd(r  ,c+1,OFF,0);
+        if (S->bkgd[r+1][c-1] == UNK)  setbkgd(r+1,c-1,OFF,0);
+        if (S->bkgd[r+1][c  ] == UNK)  setbkgd(r+1,c  ,OFF,0);
+        if (S->bkgd[r+1][c+1] == UNK)  setbkgd(r+1,c+1,OFF,0);
         return OK;
 
       case NAYSON:
-        if (bkgd[r-1][c-1] == UNK)  setbkgd(r-1,c-1,ON,0);
-        if (bkgd[r-1][c  ] == UNK)  setbkgd(r-1,c  ,ON,0);
-        if (bkgd[r-1][c+1] == UNK)  setbkgd(r-1,c+1,ON,0);
-        if (bkgd[r  ][c-1] == UNK)  setbkgd(r  ,c-1,ON,0);
-        if (bkgd[r  ][c+1] == UNK)  setbkgd(r  ,c+1,ON,0);
-        if (bkgd[r+1][c-1] == UNK)  setbkgd(r+1,c-1,ON,0);
-        if (bkgd[r+1][c  ] == UNK)  setbkgd(r+1,c  ,ON,0);
-        if (bkgd[r+1][c+1] == UNK)  setbkgd(r+1,c+1,ON,0);
+        if (S->bkgd[r-1][c-1] == UNK)  setbkgd(r-1,c-1,ON,0);
+        if (S->bkgd[r-1][c  ] == UNK)  setbkgd(r-1,c  ,ON,0);
+        if (S->bkgd[r-1][c+1] == UNK)  setbkgd(r-1,c+1,ON,0);
+        if (S->bkgd[r  ][c-1] == UNK)  setbkgd(r  ,c-1,ON,0);
+        if (S->bkgd[r  ][c+1] == UNK)  setbkgd(r  ,c+1,ON,0);
+        if (S->bkgd[r+1][c-1] == UNK)  setbkgd(r+1,c-1,ON,0);
+        if (S->bkgd[r+1][c  ] == UNK)  setbkgd(r+1,c  ,ON,0);
+        if (S->bkgd[r+1][c+1] == UNK)  setbkgd(r+1,c+1,ON,0);
         return OK;
 
       case CELLOFF:
@@ -443,77 +828,296 @@ START:
 
 /* -------------------------------------------------------------------- */
 
-char consis9(int r, int c)  /* fcn */
-/* Call consistify for (r,c) and each of its 8 neighbors.  If inconsistency
-   found, return ERR.
+/* proceed and listneighbors take their stamps from the same increasing
+   sequence.  proceed gives each setting it makes a stamp, stampbase plus
+   its index in settinglist, and when consis9 examines a cell, it sets
+   the cell's mark to the stamp of the next setting.  So a cell whose mark
+   is later than a setting's stamp has been examined since that setting
+   was made, and needn't be examined again for it; if any of its other
+   neighbors have been set since then, it will be for them.  That way each
+   cell is examined once for each change to its neighborhood, rather than
+   once for each new setting next to it.  consistify is only called if
+   consistable says something's forced or inconsistent, since most
+   neighborhoods are neither.
 */
-{ 
 
+char consisnote(int r, int c)   /* fcn */
+/* Call consistify(r,c), and note that the settings it makes were forced
+   by the neighborhood of (r,c), and that (r,c) is where the contradiction
+   is if it finds one.  learnnogood uses them.  Only used if there's a
+   nogood store.
+*/
+{ setting *st = S->nwstng;
+  char result;
+
+  result = consistify(r,c);
+  for ( ; st<S->nwstng; st++)
+    { S->forcedby[st - S->settinglist].row = r;
+      S->forcedby[st - S->settinglist].col = c;
+    }
+  S->conflictat.row = r;
+  S->conflictat.col = c;
+  return result;
+}
+
+#define check(r,c) \
+  if (S->mark[r][c] <= t) \
+    { S->mark[r][c] = S->stampbase + (S->nwstng - S->settinglist); \
+      if (S->rules->consistable[S->bkgd[r][c]][S->naysum[r][c]] != NOINFO \
+          && (S->nogoods ? consisnote(r,c) : consistify(r,c))) \
+        return ERR; \
+    }
+
+char consis9(int r, int c, unsigned int t)  /* fcn */
+/* Call consistify for (r,c) and each of its 8 neighbors, except those
+   examined since stamp t, when (r,c) was set.  If inconsistency found,
+   return ERR.
+*/
+{
 #if COUNT
-  countconsis9++;
+  S->countconsis9++;
 #endif
 
-  if (consistify(r,c))  return ERR;
-  if (consistify(r-1,c  ))  return ERR;
-  if (consistify(r  ,c-1))  return ERR;
-  if (consistify(r+1,c  ))  return ERR;
-  if (consistify(r  ,c+1))  return ERR;
-  if (consistify(r-1,c-1))  return ERR;
-  if (consistify(r+1,c-1))  return ERR;
-  if (consistify(r-1,c+1))  return ERR;
-  if (consistify(r+1,c+1))  return ERR;
+  check(r  ,c  )  check(r-1,c  )  check(r  ,c-1)
+  check(r+1,c  )  check(r  ,c+1)  check(r-1,c-1)
+  check(r+1,c-1)  check(r-1,c+1)  check(r+1,c+1)
   return OK;
 }
 
 /* -------------------------------------------------------------------- */
 
+/* A nogood records that setting a cell to val led proceed to a
+   contradiction, given the values of some of the cells in the window of
+   radius NGRAD around it.  Each cell that consistify sets is forced by
+   the known cells in the neighborhood of the cell it was called for, so
+   learnnogood can trace the contradiction back through those
+   neighborhoods to the cells that were known before proceed started.
+   Only those cells (and the 3x3 block around the cell, whose values,
+   including UNK, the nogoods are hashed on) are kept.  Wherever they
+   have the same values again, with any values or UNK in the rest of the
+   window, consistify would find the same settings forced in the same
+   neighborhoods, since consistable says all that can be said about one
+   neighborhood and knowing more cells can only force more; so the
+   contradiction comes up again and proceed can give up at once.  (Not
+   with symmetry, which sets cells outside the window.)  The nogoods are
+   kept in a hash table of buckets of NGWAYS entries; a new one replaces
+   the least recently used one in its bucket.
+*/
+
+void nogoodinit(searchstate *s)    /* fcn */
+/* Allocate an empty nogood store for s, with at least nogoodsize entries.
+*/
+{ long int size;
+
+  for (size=NGWAYS; size<s->nogoodsize; size*=2)  ;
+  s->nogoodsize = size;
+  if (!(s->nogoods = calloc(size, sizeof(nogood))))
+    err("Out of memory for nogoods");
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean nogoodkey(int r, int c, unsigned char v, nogood *key)    /* fcn */
+/* Put the window around (r,c) and v in key.  Return FALSE if nogoods
+   can't be used there.
+*/
+{ int dr, k;
+  unsigned char *row;
+  unsigned long int w;
+
+  if (S->SYMM != NOSYMM || r < NGRAD || r >= S->HT-NGRAD ||
+      c < NGRAD || c >= S->WD-NGRAD)
+    return FALSE;
+
+  key->cells[0] = key->cells[1] = key->cells[2] = 0;
+  for (dr=-NGRAD, k=0; dr<=NGRAD; dr++, k++)
+    { /* Pack the first 8 cells of the row 8 bits at a time, then 4, */
+      /* then 2 (OFF, ON, UNK -> 0, 1, 2), and add the 9th.          */
+      row = S->bkgd[r+dr] + c-NGRAD;
+      memcpy(&w, row, 8);
+      w = (w | w>>3) & 0x0303030303030303UL;
+      w = (w | w>>6) & 0x000f000f000f000fUL;
+      w = (w | w>>12) & 0x000000ff000000ffUL;
+      w = (w | w>>24) & 0xffff;
+      w |= (unsigned long int) ((row[8] | row[8]>>3) & 3) << 16;
+      key->cells[k/3] |= w << 18*(k%3);
+    }
+  key->val = v;
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+nogood *nogoodbucket(nogood *key)   /* fcn */
+/* Return the bucket of the nogood store that key belongs in. */
+{ unsigned long int h;
+
+  h = ((key->cells[1] & NGCORE) * 0xc2b2ae3d27d4eb4fUL) ^ key->val;
+  h ^= h >> 29;
+  return S->nogoods + (h & (S->nogoodsize/NGWAYS-1)) * NGWAYS;
+}
+
+/* -------------------------------------------------------------------- */
+
+nogood *findnogood(nogood *key)   /* fcn */
+/* Return the stored nogood that matches key, or NULL if none. */
+{ nogood *ng;
+  int i;
+
+  for (ng=nogoodbucket(key), i=0; i<NGWAYS; ng++, i++)
+    if (ng->inuse && ng->val == key->val &&
+        (key->cells[0] & ng->mask[0]) == ng->cells[0] &&
+        (key->cells[1] & ng->mask[1]) == ng->cells[1] &&
+        (key->cells[2] & ng->mask[2]) == ng->cells[2])
+      { ng->lastuse = ++S->nogoodclock;
+        return ng;
+      }
+  return NULL;
+}
+
+/* -------------------------------------------------------------------- */
+
+void learnnogood(int r, int c, setting *start, nogood *key)   /* fcn */
+/* proceed found a contradiction in the neighborhood of conflictat after
+   making the settings from start on, the first of which was (r,c).  Trace
+   it back to the cells that were known before, and if they're all in the
+   window around (r,c), store them and key as a nogood.
+*/
+{ int at[2*NGRAD+5][2*NGRAD+5],  /* k+1 if the cell within NGRAD+2 of */
+                                 /* (r,c) is start[k], -(k+1) once    */
+                                 /* its neighborhood has been traced  */
+      stack[(2*NGRAD+5)*(2*NGRAD+5)], sp, k, lim, rn, cn, i, j, bit;
+  setting *st;
+  cellref *nb;
+  nogood *ng, *oldest;
+
+  memset(at, 0, sizeof(at));
+  for (st=start, k=1; st<S->nwstng; st++, k++)
+    if (diff(st->row, r) <= NGRAD+2 && diff(st->col, c) <= NGRAD+2)
+      at[st->row-r+NGRAD+2][st->col-c+NGRAD+2] = k;
+
+  key->mask[0] = key->mask[2] = 0;
+  key->mask[1] = NGCORE;
+  nb = &S->conflictat;
+  lim = S->nwstng - start + 1;  /* Everything was known by then */
+  sp = 0;
+  while (TRUE)
+    { /* The cells known before start[lim-1] was set force it */
+      for (i=-1; i<=1; i++)
+        for (j=-1; j<=1; j++)
+          { rn = nb->row+i;  cn = nb->col+j;
+            if (S->bkgd[rn][cn] == UNK)  continue;
+            if (diff(rn, r) > NGRAD+2 || diff(cn, c) > NGRAD+2)  return;
+            k = at[rn-r+NGRAD+2][cn-c+NGRAD+2];
+            if (abs(k) >= lim)  continue;
+            if (diff(rn, r) > NGRAD || diff(cn, c) > NGRAD)  return;
+            if (k == 0)         /* Known before proceed */
+              { bit = 2 * ((rn-r+NGRAD)%3 * (2*NGRAD+1) + cn-c+NGRAD);
+                key->mask[(rn-r+NGRAD)/3] |= 3UL << bit;
+              }
+            else if (k > 1)     /* Set by consistify; trace it back too */
+              { at[rn-r+NGRAD+2][cn-c+NGRAD+2] = -k;
+                stack[sp++] = k;
+              }
+          }
+      if (sp == 0)  break;
+      lim = stack[--sp];
+      nb = &S->forcedby[start - S->settinglist + lim-1];
+    }
+
+  for (i=0; i<3; i++)  key->cells[i] &= key->mask[i];
+  oldest = ng = nogoodbucket(key);
+  for (i=0; i<NGWAYS; ng++, i++)
+    if (ng->lastuse < oldest->lastuse)  oldest = ng;
+    /* An empty entry has lastuse 0, so it's taken first */
+  *oldest = *key;
+  oldest->inuse = TRUE;
+  oldest->saved = min(S->nwstng-start-1, 65535);
+  oldest->lastuse = ++S->nogoodclock;
+  S->nogoodlearned++;
+}
+
+/* -------------------------------------------------------------------- */
+
 char proceed(int r, int c, unsigned char v, boolean f)  /* fcn */
 /* Set bkgd[r,c] to v and examine consequences.  Return ERR if
    inconsistency found.
 */
-{
+{ nogood key, *ng;
+  setting *start = S->nwstng;
+  boolean learn = FALSE;
 
 #if COUNT
-  countproceed++;
-  if (TRACE) {printf("  proceed(%d,%d,%d,%d)\n",r,c,(int)v,(int)f);fflush(stdout);}
+  S->countproceed++;
+  if (TRACE) {fprintf(S->out, "  proceed(%d,%d,%d,%d)\n",r,c,(int)v,(int)f);
+              fflush(S->out);}
 #endif
 
-  nxstng = nwstng;
+  if (S->nogoods && nogoodkey(r,c,v,&key))
+    { if ((ng = findnogood(&key)))
+        { S->nogoodhits++;
+          S->nogoodsaved += ng->saved;
+          setbkgd(r,c,v,f);     /* So backup finds it if it's free */
+          return ERR;
+        }
+      learn = TRUE;
+    }
+
+  if (S->stamp >= UINT_MAX - S->HT*S->WD)
+    { memset(S->mark[0], 0, gridbytes(S, S->mark));
+      S->stamp = 0;
+    }
+  S->stampbase = S->stamp+1 - (start - S->settinglist);
+
+  S->nxstng = S->nwstng;
   setbkgd(r,c,v,f);
-  while (nxstng != nwstng)
-    if (consis9(nxstng->row, nxstng->col))  return ERR;
-    else  nxstng++;
+  while (S->nxstng != S->nwstng)
+    if (consis9(S->nxstng->row, S->nxstng->col,
+                S->stampbase + (S->nxstng - S->settinglist)))
+      { S->stamp = S->stampbase + (S->nwstng - S->settinglist);
+        if (learn)  learnnogood(r,c,start,&key);
+        return ERR;
+      }
+    else  S->nxstng++;
+  S->stamp = S->stampbase + (S->nwstng - S->settinglist);
   return OK;
 }
 
 /* -------------------------------------------------------------------- */
 
 
+#define unset() \
+  S->nwstng--; \
+  inc = UNK - S->bkgd[r = S->nwstng->row][c = S->nwstng->col]; \
+  S->bkgd[r][c] = UNK; \
+  S->curr[r][c] = UNK; \
+  S->naysum[r-1][c-1] += inc; \
+  S->naysum[r-1][c  ] += inc; \
+  S->naysum[r-1][c+1] += inc; \
+  S->naysum[r  ][c-1] += inc; \
+  S->naysum[r  ][c+1] += inc; \
+  S->naysum[r+1][c-1] += inc; \
+  S->naysum[r+1][c  ] += inc; \
+  S->naysum[r+1][c+1] += inc;
+/* Undo the last setting */
+
 char backup(void)   /* fcn */
 /* Back up to last free choice.  Return ERR if none left.
    After return, nwstng still points to previous choice.
 */
-{ static int r, c, inc;
+{ int r, c, inc;
 
 #if COUNT
-  countbackup++;
-  if (TRACE)  {printf("  backup()\n");fflush(stdout);}
+  S->countbackup++;
+  if (TRACE)  {fprintf(S->out, "  backup()\n");fflush(S->out);}
 #endif
 
-  while (nwstng > settinglist)
-    { nwstng--;
-      inc = UNK - bkgd[r = nwstng->row][c = nwstng->col];
-      bkgd[r][c] = UNK;
-      curr[r][c] = UNK;
-	  naysum[r-1][c-1] += inc;
-	  naysum[r-1][c  ] += inc;
-	  naysum[r-1][c+1] += inc;
-	  naysum[r  ][c-1] += inc;
-	  naysum[r  ][c+1] += inc;
-	  naysum[r+1][c-1] += inc;
-	  naysum[r+1][c  ] += inc;
-	  naysum[r+1][c+1] += inc;
-      if (nwstng->free)  return OK;
+  while (S->nwstng > S->settinglist)
+    { unset()
+      if (S->nwstng->free)
+        { S->depth--;
+          if (S->nwstng->free == TRUE)  return OK;
+        }
     }
 
   return ERR;
@@ -530,55 +1134,158 @@ char go(int r, int c, unsigned char v, boolean f,   /* fcn */
 { 
 
 #if COUNT
-  countgo++;
-  if (TRACE)  {printf(" go(%d,%d,%d,%d,-)\n",r,c,(int)v,(int)f);fflush(stdout);}
+  S->countgo++;
+  if (TRACE)  {fprintf(S->out, " go(%d,%d,%d,%d,-)\n",r,c,(int)v,(int)f);
+               fflush(S->out);}
 #endif
 
-  *wasfree = nwstng;
+  *wasfree = S->nwstng;
   while (proceed(r,c,v,f))
     { if (backup())  return ERR;
-      r = nwstng->row;
-      c = nwstng->col;
-      v = !nwstng->val;
-      f = 0;
-      *wasfree = nwstng;
+      r = S->nwstng->row;
+      c = S->nwstng->col;
+      v = !S->nwstng->val;
+      f = FLIPPED;
+      *wasfree = S->nwstng;
     }
   return OK;
 }
 
+/* -------------------------------------------------------------------- */
+
+int probe(int r, int c, unsigned char v)   /* fcn */
+/* Return the number of settings made by setting the UNK cell (r,c) to v
+   and examining the consequences, or -1 if that's inconsistent.  The
+   settings are undone afterward.
+*/
+{ setting *start = S->nwstng;
+  int n, inc;
+
+  n = proceed(r,c,v,0) ? -1 : S->nwstng-start;
+  while (S->nwstng > start)
+    { unset()
+    }
+  return n;
+}
+
+/* -------------------------------------------------------------------- */
+
+int nbhdorder[9][2] = {{0,0}, {-1,0}, {0,-1}, {1,0}, {0,1},
+                       {-1,-1}, {1,-1}, {-1,1}, {1,1}};
+    /* Order in which the cells around a cell are considered for a free
+       choice: center, edges, corners */
+
+int choosecell(int r, int c, int *ru, int *cu)  /* fcn */
+/* nxgen(r,c) is UNK, so some cell in the 3x3 block around (r,c) is UNK.
+   Pick one of them for a free choice, according to branchcell, and put
+   it in (ru,cu).  If probing finds that one value of the cell is
+   inconsistent, return the other value, which is forced; otherwise
+   return -1.
+*/
+{ int i, rn, cn, best, score, off, on;
+
+  best = -9;        /* Below any score */
+  for (i=0; i<9; i++)
+    { rn = r+nbhdorder[i][0];  cn = c+nbhdorder[i][1];
+      if (S->bkgd[rn][cn] != UNK)  continue;
+
+      switch (S->branchcell)
+        { case FIRSTCELL:
+            *ru = rn;  *cu = cn;
+            return -1;
+
+          default:                  /* CONSTRAINEDCELL: fewest UNK neighbors */
+            score = -(S->naysum[rn][cn] / UNK);
+            break;
+
+          case PROBECELL:           /* Most settings forced by either value */
+            if ((off = probe(rn,cn,OFF)) < 0)
+              { *ru = rn;  *cu = cn;
+                return ON;
+              }
+            if ((on = probe(rn,cn,ON)) < 0)
+              { *ru = rn;  *cu = cn;
+                return OFF;
+              }
+            score = min(off, on);
+            break;
+        }
+      if (score > best)
+        { best = score;
+          *ru = rn;  *cu = cn;
+        }
+    }
+  return -1;
+}
+
+/* -------------------------------------------------------------------- */
+
+unsigned char choosevalue(int r, int c) /* fcn */
+/* Pick the value to try first for a free choice of cell (r,c), according
+   to branchvalue.
+*/
+{ int v, i, rn, cn, sum, forces[2];
+
+  if (S->branchvalue == LEASTVALUE)
+    { /* Count the cells in the 3x3 block whose neighborhoods would force */
+      /* something if (r,c) got each value, and take the value that      */
+      /* forces less.  (Neither value is inconsistent outright, since    */
+      /* consistify would have set the cell already.)                    */
+      for (v=OFF; v<=ON; v++)
+        { forces[v] = S->rules->consistable[v][S->naysum[r][c]] != NOINFO;
+          for (i=1; i<9; i++)
+            { rn = r+nbhdorder[i][0];  cn = c+nbhdorder[i][1];
+              sum = S->naysum[rn][cn] + v - UNK;
+              forces[v] +=
+                S->rules->consistable[S->bkgd[rn][cn]][sum] != NOINFO;
+            }
+        }
+      if (forces[OFF] != forces[ON])
+        return forces[OFF] > forces[ON];
+    }
+  return myrandom(100)<S->prob;
+}
+
 /************************************************************************/
 /* The following functions handle advancing the pattern.                */
 /************************************************************************/
 
-#define append(r,c) \
-  for (nay=nays[gen], alreadyinlist=0; nay<chgd[gen+1]; nay++) \
-    if (nay->row == r && nay->col == c)  { alreadyinlist=1; break; } \
-  if (!alreadyinlist) \
-    { chgd[gen+1]->row = r;  (chgd[gen+1]++)->col = c; \
-    }
-#if 0
-      chgd[gen+1]->row = -1;}
-#endif
-/*  zzz      Is this needed?   */
+int sum9(unsigned char **a, int r, int c)    /* fcn */
+/* Return the sum of a[r-1,c-1], ..., a[r+1,c+1]. */
+{ return a[r-1][c-1] + a[r-1][c] + a[r-1][c+1] +
+         a[r  ][c-1] + a[r  ][c] + a[r  ][c+1] +
+         a[r+1][c-1] + a[r+1][c] + a[r+1][c+1];
+}
 
+/* -------------------------------------------------------------------- */
 
+#define append(r,c) \
+  if (S->mark[r][c] != S->stamp) \
+    { S->mark[r][c] = S->stamp; \
+      S->chgd[gen+1]->row = r;  (S->chgd[gen+1]++)->col = c; \
+    }
 
 void listneighbors(int gen) /* fcn */
 /* Given list of changed cells in generation gen (from chgd[gen] to
    nays[gen]-1), create list of their neighbors (from nays[gen] to
    chgd[gen+1]).
 */
-{ static point *chg, *nay, tmp, *p, *q;
-  static boolean alreadyinlist;
-  static int r,c,tmpcount;
+{ point *chg, *p, *sorted;
+  int r,c,n,count[9*UNK+2];
 
 #if COUNT
-  countlistneighbors++;
-  if (TRACE) {printf("listneighbors(%d)\n",gen);fflush(stdout);}
+  S->countlistneighbors++;
+  if (TRACE) {fprintf(S->out, "listneighbors(%d)\n",gen);fflush(S->out);}
 #endif
 
-  chgd[gen+1] = nays[gen];
-  for (chg=chgd[gen]; chg<nays[gen]; chg++)
+  /* A cell is in the list if its mark is the current stamp */
+  if (++S->stamp == 0)
+    { memset(S->mark[0], 0, gridbytes(S, S->mark));
+      S->stamp = 1;
+    }
+
+  S->chgd[gen+1] = S->nays[gen];
+  for (chg=S->chgd[gen]; chg<S->nays[gen]; chg++)
     { r = chg->row;  c = chg->col;
       append(r,c);
       append(r-1,c-1);  append(r-1,c  );  append(r-1,c+1);
@@ -586,33 +1293,29 @@ void listneighbors(int gen) /* fcn */
       append(r+1,c-1);  append(r+1,c  );  append(r+1,c+1);
     }
 
-  if (chgd[gen+1]-chglist>=CHGLISTLTH)				/* From Gabriel Nivasch */
-     { printf("chgd[%d]-chglist = %d\n", gen, chgd[gen+1]-chglist);
+  /* The sorted list is built just past the end of the list */
+  n = S->chgd[gen+1] - S->nays[gen];
+  if (S->chgd[gen+1]+n-S->chglist>=CHGLISTLTH)		/* From Gabriel Nivasch */
+     { fprintf(S->out, "chgd[%d]-chglist = %d\n",
+                        gen, (int) (S->chgd[gen+1]-S->chglist));
 	   err("Overflow of chglist at listneighbors().\n")	/* From GN */
 	 }
 
-  /* Bubble sort into increasing order by number of UNK neighbors */
-  for (p=nays[gen]+1; p<chgd[gen+1]; p++)
-    { tmp = *p;
-      r = tmp.row;  c = tmp.col;
-      tmpcount = bkgd[r-1][c-1] + bkgd[r-1][c] + bkgd[r-1][c+1] +
-                 bkgd[r  ][c-1] + bkgd[r  ][c] + bkgd[r  ][c+1] +
-                 bkgd[r+1][c-1] + bkgd[r+1][c] + bkgd[r+1][c+1];
-      for (q=p-1; q>=nays[gen]; q--)
-        { r = q->row;  c = q->col;
-          if (bkgd[r-1][c-1] + bkgd[r-1][c] + bkgd[r-1][c+1] +
-              bkgd[r  ][c-1] + bkgd[r  ][c] + bkgd[r  ][c+1] +
-              bkgd[r+1][c-1] + bkgd[r+1][c] + bkgd[r+1][c+1] > tmpcount)
-            *(q+1) = *q;
-          else  break;
-        }
-      *(q+1) = tmp;
-    }
+  /* Sort into increasing order by sum of bkgd in 3x3 block (i.e. mainly */
+  /* by number of UNK neighbors), keeping the order of equal ones.       */
+  memset(count, 0, sizeof(count));
+  for (p=S->nays[gen]; p<S->chgd[gen+1]; p++)
+    count[sum9(S->bkgd, p->row, p->col) + 1]++;
+  for (r=1; r<=9*UNK; r++)  count[r] += count[r-1];
+  sorted = S->chgd[gen+1];
+  for (p=S->nays[gen]; p<S->chgd[gen+1]; p++)
+    sorted[count[sum9(S->bkgd, p->row, p->col)]++] = *p;
+  memcpy(S->nays[gen], sorted, n*sizeof(point));
 }
 
 /* -------------------------------------------------------------------- */
 
-void changecurr(unsigned char curr[][MAXWD], int gen)   /* fcn */
+void changecurr(unsigned char **curr, int gen)   /* fcn */
 /* Toggle values in curr of cells pointed to by chgd[gen].  This is used
    to either make curr equal to bkgd or to make it contain the current
    generation.
@@ -621,10 +1324,10 @@ void changecurr(unsigned char curr[][MAXWD], int gen)   /* fcn */
   int r,c;
 
 #if COUNT
-  countchangecurr++;
+  S->countchangecurr++;
 #endif
 
-  for (p=chgd[gen]; p<nays[gen]; p++)
+  for (p=S->chgd[gen]; p<S->nays[gen]; p++)
     { r = p->row;  c = p->col;
       if (curr[r][c] == UNK)  err2("BUG in changecurr: r=%d c=%d\n",r,c);
       curr[r][c] ^= 1;
@@ -633,34 +1336,106 @@ void changecurr(unsigned char curr[][MAXWD], int gen)   /* fcn */
 
 /* -------------------------------------------------------------------- */
 
+/* changedin only has one word for each cell, so it only covers the
+   first 64 gens, which is where nearly all of the changes are.  For later
+   gens, waschanged looks through the list of changes, which is short.
+*/
+
+boolean waschanged(int r, int c, int g)   /* fcn */
+/* Return TRUE if (r,c) is in the list of changes in gen g, which is
+   complete unless g is gen.
+*/
+{ point *p, *end;
+
+  if (g < 64)  return S->changedin[r][c] >> g & 1;
+  end = g == S->gen ? S->chg : S->nays[g];
+  for (p=S->chgd[g]; p<end; p++)
+    if (p->row == r && p->col == c)  return TRUE;
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+void markchanges(point *p, point *end, int g, boolean changed)  /* fcn */
+/* Set (or clear, if changed is FALSE) bit g of changedin for the cells
+   from p to end-1.
+*/
+{ unsigned long int bit;
+
+  if (g >= 64)  return;
+  bit = 1UL << g;
+  for (; p<end; p++)
+    if (changed)  S->changedin[p->row][p->col] |= bit;
+    else          S->changedin[p->row][p->col] &= ~bit;
+}
+
+/* -------------------------------------------------------------------- */
+
+void unmarkchanges(point *from, boolean found)  /* fcn */
+/* Clear the bits of changedin for the changes at or after from in
+   chglist, which are being abandoned by backing up.  The changes in gens
+   before gen are complete; if found is FALSE, the changes in gen so far
+   are from chgd[gen] to chg-1.
+*/
+{ int g;
+
+  if (!found)  markchanges(max(S->chgd[S->gen], from), S->chg, S->gen, FALSE);
+  for (g=S->gen-1; g>0 && S->nays[g]>from; g--)
+    markchanges(max(S->chgd[g], from), S->nays[g], g, FALSE);
+}
+
+/* -------------------------------------------------------------------- */
+
+int firstchange(int r, int c, int gen)  /* fcn */
+/* Return the first gen before gen in which (r,c) is changed, or gen if
+   there's none.
+*/
+{ int g;
+  unsigned long int w;
+
+  if ((w = S->changedin[r][c]))
+    { for (g=0; !(w&1); w>>=1)  g++;
+      return min(g, gen);
+    }
+  for (g=64; g<gen; g++)
+    if (waschanged(r,c,g))  return g;
+  return gen;
+}
+
+/* -------------------------------------------------------------------- */
+
 char nxgen(int r, int c)    /* fcn */
 /* Given curr[r-1,c-1], ..., curr[r+1,c+1].  Tries to compute next gen
    of cell (r,c).  Returns UNK if can't tell or if curr[r,c] is UNK.
 */
-{ unsigned char val, newval;
+{ unsigned char val;
 
 #if COUNT
-  countnxgen++;
+  S->countnxgen++;
 #endif
 
-  if ((val = curr[r][c]) == UNK)  return UNK;
-  newval = transtable[val]
-    [ curr[r-1][c-1] + curr[r-1][c] + curr[r-1][c+1] +
-      curr[r  ][c-1] +                curr[r  ][c+1] +
-      curr[r+1][c-1] + curr[r+1][c] + curr[r+1][c+1] ];
-  if (!var[136])  return newval;
-
-  /* Kludge for Just Friends rule */
-  /* If var[136], then disallow birth if the parents are adjacent */
-  if (val!=OFF || newval!=ON)  return newval;
-  if ((curr[r-1][c-1] + curr[r-1][c  ] == 2) ||
-      (curr[r-1][c  ] + curr[r-1][c+1] == 2) ||
-      (curr[r-1][c+1] + curr[r  ][c+1] == 2) ||
-      (curr[r  ][c+1] + curr[r+1][c+1] == 2) ||
-      (curr[r+1][c+1] + curr[r+1][c  ] == 2) ||
-      (curr[r+1][c  ] + curr[r+1][c-1] == 2) ||
-      (curr[r+1][c-1] + curr[r  ][c-1] == 2) ||
-      (curr[r  ][c-1] + curr[r-1][c-1] == 2))  return OFF;
+  if ((val = S->curr[r][c]) == UNK)  return UNK;
+  return S->rules->transtable[val][sum9(S->curr, r, c) - val];
+}
+
+/* -------------------------------------------------------------------- */
+
+char jfnxgen(int r, int c)  /* fcn */
+/* Same as nxgen, for the Just Friends rule (var[136]): birth is
+   disallowed if the parents are adjacent.  It's a separate function so
+   that other rules don't pay for the test.
+*/
+{ unsigned char newval;
+
+  if ((newval = nxgen(r,c)) != ON || S->curr[r][c] != OFF)  return newval;
+  if ((S->curr[r-1][c-1] + S->curr[r-1][c  ] == 2) ||
+      (S->curr[r-1][c  ] + S->curr[r-1][c+1] == 2) ||
+      (S->curr[r-1][c+1] + S->curr[r  ][c+1] == 2) ||
+      (S->curr[r  ][c+1] + S->curr[r+1][c+1] == 2) ||
+      (S->curr[r+1][c+1] + S->curr[r+1][c  ] == 2) ||
+      (S->curr[r+1][c  ] + S->curr[r+1][c-1] == 2) ||
+      (S->curr[r+1][c-1] + S->curr[r  ][c-1] == 2) ||
+      (S->curr[r  ][c-1] + S->curr[r-1][c-1] == 2))  return OFF;
   return ON;
 }
 
@@ -672,250 +1447,673 @@ void findchgcount(int g)	/* fcn */
    called when gen g has been finished; i.e. nays[g] has been set.
    Also compute and save width and height of changed region.
 */
-{ static point *q, *qm;
-  static int minr,maxr,minc,maxc, r,c, qr,qc,g0;
+{ point *q, *qm;
+  int minr,maxr,minc,maxc, r,c, qr,qc,g0;
 
-  if (g<var[106])  chgcount[g] = width[g] = height[g] = 0;
+  if (g<S->var[106])  S->chgcount[g] = S->width[g] = S->height[g] = 0;
   else
-    { chgcount[g]=0;
+    { S->chgcount[g]=0;
 	  maxc = maxr = -1;
-	  minr = HT;  minc = WD;
-	  for (q=chgd[g]; q<nays[g]; q++)
-        if (!(flag[r = q->row][c = q->col] & DONTCOUNT))
-	      { chgcount[g]++;
+	  minr = S->HT;  minc = S->WD;
+	  for (q=S->chgd[g]; q<S->nays[g]; q++)
+        if (!(S->flag[r = q->row][c = q->col] & DONTCOUNT))
+	      { S->chgcount[g]++;
 			if (r<minr)  minr=r;
 			if (r>maxr)  maxr=r;
 			if (c<minc)  minc=c;
 			if (c>maxc)  maxc=c;
 		  }
 
-	  width[g]  = maxc==-1 ? 0 : maxc - minc + 1;
-	  height[g] = maxr==-1 ? 0 : maxr - minr + 1;
+	  S->width[g]  = maxc==-1 ? 0 : maxc - minc + 1;
+	  S->height[g] = maxr==-1 ? 0 : maxr - minr + 1;
 	}
 
   /* Record sum of ages of all changes */
-  if (var[129] && g==0)
-    { for (q=chgd[g], agesm[g]=0; q<nays[g]; q++)
+  if (S->var[129] && g==0)
+    { for (q=S->chgd[g], S->agesm[g]=0; q<S->nays[g]; q++)
         { qr = q->row;  qc = q->col;
           for (g0=0; g0<g; g0++)
-            for (qm=chgd[g0]; qm<nays[g0]; qm++)
+            for (qm=S->chgd[g0]; qm<S->nays[g0]; qm++)
               if (qm->row == qr && qm->col == qc)
                 goto FOUNDFIRST;
 
         FOUNDFIRST:
-          agesm[g] += g-g0+1;
+          S->agesm[g] += g-g0+1;
         }
     }
 }
 
 /* -------------------------------------------------------------------- */
 
-char trycell(void)  /* fcn */
-/* Given gen>0, nays[gen-1] <= nay < chgd[gen] <= chg.
-   Tries to compute next gen of cell specified by nay, possibly setting
-   bkgd of its neighbors to ON or OFF.  Returns ERR if problem occurs, in
-   which case we must back up.
+int getpath(char *path) /* fcn */
+/* Put the values of the free choices in settinglist into path, as a
+   string of '0's and '1's.  Return its length.
 */
-{ static int r,c,g,qr,qc,minqr,maxqr,minqc,maxqc,ru,cu,changecount,agesum,pgen;
-  static unsigned char val;
-  static point *q, *qm;
-  static boolean oldchange, recentbig,recentwide,recenttall,changeding;
+{ setting *st;
+  int lth;
 
-  r = nay->row;  c = nay->col;
+  for (st=S->settinglist, lth=0; st<S->nwstng; st++)
+    if (st->free)  path[lth++] = '0' + st->val;
+  path[lth] = 0;
+  return lth;
+}
 
-#if COUNT
-  counttrycell++;
-  if (TRACE)  {printf(" trycell()\n");fflush(stdout);}
-#endif
+/* -------------------------------------------------------------------- */
 
-  while ((val = nxgen(r,c)) == UNK)
-    { if (bkgd[r][c] == UNK)            { ru = r;    cu = c;   }
-      else if (bkgd[r-1][c  ] == UNK)   { ru = r-1;  cu = c;   }
-      else if (bkgd[r  ][c-1] == UNK)   { ru = r;    cu = c-1; }
-      else if (bkgd[r+1][c  ] == UNK)   { ru = r+1;  cu = c;   }
-      else if (bkgd[r  ][c+1] == UNK)   { ru = r;    cu = c+1; }
-      else if (bkgd[r-1][c-1] == UNK)   { ru = r-1;  cu = c-1; }
-      else if (bkgd[r+1][c-1] == UNK)   { ru = r+1;  cu = c-1; }
-      else if (bkgd[r-1][c+1] == UNK)   { ru = r-1;  cu = c+1; }
-      else if (bkgd[r+1][c+1] == UNK)   { ru = r+1;  cu = c+1; }
+int pathowner(char *path)   /* fcn */
+/* Return the part (0 to splitcount-1) that searches the subtree below
+   path, in a piece shared by all parts.  This depends only on the path,
+   not on the order in which the subtrees are reached, so all parts agree
+   on it.
+*/
+{ unsigned long int h;
 
-      nwstng->gen = gen;
-      nwstng->nay = nay;
-      nwstng->chg = chg;
+  for (h=1; *path; path++)  h = 31*h + *path;
+  h ^= h >> 29;  h *= 0xbf58476d1ce4e5b9UL;  h ^= h >> 32;
+  return h % S->splitcount;
+}
 
-      val = myrandom(100)<prob;
-      if (proceed(ru,cu,val,1))  return ERR;
+/* -------------------------------------------------------------------- */
+
+int findpiece(char *path, boolean *inside)  /* fcn */
+/* Return the index of the piece of the split search that contains the
+   subtree below path, and set *inside.  If path is above the pieces,
+   return the index of the first piece below it, and clear *inside.
+*/
+{ int lo, hi, mid;
+
+  for (lo=0, hi=S->numpieces; lo<hi; )     /* Find first piece >= path */
+    { mid = (lo+hi)/2;
+      if (strcmp(S->pieces[mid].path, path) < 0)  lo = mid+1;
+      else                                        hi = mid;
+    }
+  if (lo < S->numpieces && !strcmp(S->pieces[lo].path, path))
+    *inside = TRUE;
+  else if (lo > 0 && !strncmp(S->pieces[lo-1].path, path,
+                              strlen(S->pieces[lo-1].path)))
+    { *inside = TRUE;      /* The pieces don't overlap, so only the one */
+      lo--;                /* just before path can contain it           */
+    }
+  else
+    *inside = FALSE;
+  return lo < S->numpieces ? lo : S->numpieces-1;
+}
+
+/* -------------------------------------------------------------------- */
+
+int shareddepth(void)   /* fcn */
+/* Return the depth at which the piece we're in is cut among the parts,
+   if it's shared, or INT_MAX if it isn't.
+*/
+{ if (S->piecedepth == INT_MAX || S->pieces[S->piece].owner >= 0)
+    return INT_MAX;
+  return S->piecedepth > S->splitdepth ? S->piecedepth : S->splitdepth;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean pruned(void)    /* fcn */
+/* Called after a free choice has been made, if the search is split or
+   we're listing the frontier.  Return TRUE if the subtree below it isn't
+   ours: when listing the frontier, if the choice is at depth splitdepth
+   (in which case its path is printed); when the search is split, if it's
+   the root of a piece that belongs to another part, or the root of a
+   subtree at the cut in a shared piece that belongs to another part.
+*/
+{ char *path;
+  boolean notours, inside;
+
+  if (S->splitcount ? S->depth > S->piecedepth && S->depth != shareddepth()
+                    : S->depth != S->splitdepth)
+    return FALSE;
+  if (!(path = malloc(S->depth+1)))  err("Out of memory in pruned()");
+  getpath(path);
+  if (!S->splitcount)
+    { fprintf(S->out, "path %s\n", path);
+      notours = TRUE;
+    }
+  else
+    { if (S->depth <= S->piecedepth)
+        { S->piece = findpiece(path, &inside);
+          S->piecedepth = inside ? S->depth : INT_MAX;
+        }
+      if (S->piecedepth == INT_MAX)  notours = FALSE;
+      else if (S->pieces[S->piece].owner >= 0)
+        notours = S->pieces[S->piece].owner != S->splitindex;
+      else
+        notours = S->depth == shareddepth() &&
+                  pathowner(path) != S->splitindex;
+    }
+  free(path);
+  return notours;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean ownresult(void) /* fcn */
+/* Return FALSE if the current result shouldn't be printed: if we're only
+   sampling, or if the search is split and the result, which is found by
+   more than one part, belongs to another part.  A result above the pieces
+   belongs to the part that has the first piece below it; one in a shared
+   piece above its cut belongs to the part given by a hash of its path.
+   (Results in our own pieces or subtrees are always ours.)
+*/
+{ char *path;
+  boolean ours, inside;
+  int i;
+
+  if (S->sampling)  return FALSE;
+  if (!S->splitcount)  return TRUE;
+  if (S->depth >= S->piecedepth && (S->pieces[S->piece].owner >= 0 ||
+                                    S->depth >= shareddepth()))
+    return TRUE;
+  if (!(path = malloc(S->depth+1)))  err("Out of memory in ownresult()");
+  getpath(path);
+  i = S->depth >= S->piecedepth ? S->piece : findpiece(path, &inside);
+  ours = S->pieces[i].owner >= 0 ? S->pieces[i].owner == S->splitindex
+                                 : pathowner(path) == S->splitindex;
+  free(path);
+  return ours;
+}
+
+/* -------------------------------------------------------------------- */
+
+void countcall(void)    /* fcn */
+/* Count a call to computecellorbackup. */
+{ if (++S->countcomporbackuplo == 1000000)
+    { S->countcomporbackuplo = 0;
+	  S->countcomporbackuphi++;
+	  S->newmillion = TRUE;
+	}
+}
+
+/* -------------------------------------------------------------------- */
+
+/************************************************************************/
+/* These are the optional constraints on the search, set by v# # or by  */
+/* name.  Only the enabled ones are put into the pipelines cellchecks   */
+/* and genchecks, so the others cost nothing.                           */
+/************************************************************************/
+
+boolean rightspeed(int r, int c)    /* fcn */
+/* Force signal to move right at >= 2c/3 */
+{ (void) r;
+  return 3*c < 2*S->gen + S->var[104];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean downspeed(int r, int c) /* fcn */
+/* Force signal to move down at >= 2c/3 */
+{ (void) c;
+  return 3*r < 2*S->gen + S->var[105];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean downhalfspeed(int r, int c) /* fcn */
+/* Force signal to move down at >= c/2 */
+{ (void) c;
+  return 2*r < S->gen + S->var[109];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean diagwidth(int r, int c) /* fcn */
+/* Put bound on bounding diamond (NE to SW).  The earlier changes of this
+   gen were all within bounds, so it's enough to check the whole span.
+*/
+{ (void) r;  (void) c;
+  return S->chgstat.maxdif - S->chgstat.mindif >= S->var[102];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean antidiagwidth(int r, int c) /* fcn */
+/* Put bound on bounding diamond (NW to SE) */
+{ (void) r;  (void) c;
+  return S->chgstat.maxsum - S->chgstat.minsum >= S->var[103];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean norepeat(int r, int c)  /* fcn */
+/* Don't allow cell to be changed in 2 gens between var[107] and var[108]
+   gens apart
+*/
+{ int g;
+
+  for (g=S->gen-S->var[107]; g>=S->gen-S->var[108] && g>=0; g--)
+    if (waschanged(r,c,g))  return TRUE;
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maxnew(int r, int c)    /* fcn */
+/* Put bound on number of changed cells that weren't changed last gen */
+{ int changecount;
+  point *q;
+
+  (void) r;  (void) c;
+  if (S->gen == 0)  return FALSE;
+  for (q=S->chgd[S->gen], changecount=0; q<S->chg; q++)
+    { /* Don't count change if it isn't new */
+      if (!waschanged(q->row, q->col, S->gen-1))  changecount++;
+      if (changecount > S->var[101])  return TRUE;
+    }
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maxnewsince(int r, int c)   /* fcn */
+/* Put bound on # of changed cells that weren't changed var[118] gens ago */
+{ int changecount;
+  point *q;
+
+  (void) r;  (void) c;
+  if (S->gen < S->var[118])  return FALSE;
+  for (q=S->chgd[S->gen], changecount=0; q<S->chg; q++)
+    { /* Don't count change if it isn't new */
+      if (!waschanged(q->row, q->col, S->gen-S->var[118]))  changecount++;
+      if (changecount > S->var[117])  return TRUE;
+    }
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maxagesum(int r, int c) /* fcn */
+/* Bound sum of ages of all changes */
+{ S->agesm[S->gen] += S->gen-firstchange(r,c,S->gen)+1;
+  return S->agesm[S->gen] > S->var[129];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maxrunsum(int r, int c) /* fcn */
+/* Bound sum of # of consec gens in which cell has been changed.  6/27/2008 */
+{ int g,qr,qc,pgen,agesum;
+  point *q;
+
+  (void) r;  (void) c;
+  for (q=S->chgd[S->gen], agesum=0; q<S->chg; q++)
+    { qr = q->row;  qc = q->col;
+      pgen = S->gen;  /* Earliest generation in "consecutive" */
+                      /* group in which cell changed          */
+      for (g=S->gen-1; g>=0 && g>=pgen-S->var[138]-1; g--)
+        if (waschanged(qr,qc,g))  pgen = g;
+
+      agesum += S->gen-pgen+1;
+      if (agesum > S->var[137])  return TRUE;
+    }
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maxtwos(void)   /* fcn */
+/* Allow change count = 2 in at most var[110] consecutive gens */
+{ int g;
+
+  if (S->gen < S->var[110])  return FALSE;
+  for (g=S->gen-S->var[110]; g<=S->gen; g++)
+    if (S->chgcount[g] != 2)  return FALSE;
+  fprintf(S->out, "Too many 2s\n");
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean notcount(void)  /* fcn */
+/* Exclude change count = var[122] in gen var[121] */
+{ if (S->gen==S->var[121] && S->chgcount[S->gen]==S->var[122])
+    { fprintf(S->out, "chgcount[%d] can't be %ld\n",S->gen,S->var[122]);
+      return TRUE;
+    }
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean startcount(void)    /* fcn */
+/* Require change count = var[124] up to but not including gen var[123] */
+{ if (S->gen<S->var[123] && S->chgcount[S->gen]!=S->var[124])
+    return TRUE;
+  if (S->gen==S->var[123] && S->chgcount[S->gen]==S->var[124])
+    { fprintf(S->out, "chgcount[%d] can't be %ld\n",S->gen,S->var[124]);
+      return TRUE;
+    }
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean reqcount(void)  /* fcn */
+/* Enforce the change counts given by the cc command */
+{ int n;
+
+  if (S->gen >= S->numcc)  return FALSE;
+  n = S->nays[S->gen]-S->chgd[S->gen];
+  if (S->reqchgcount[S->gen] >= 0)
+    return n != S->reqchgcount[S->gen];
+  return n == -S->reqchgcount[S->gen];
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean samesize(void)  /* fcn */
+/* Change count and bounding box size must be same in generations gen and
+   gen-var[128]
+*/
+{ int g;
+
+  if (S->gen < S->var[128])  return FALSE;
+  g = S->gen-S->var[128];
+  return !(S->chgcount[S->gen] == S->chgcount[g] &&
+           ((S->width[S->gen] == S->width[g] &&
+             S->height[S->gen] == S->height[g]) ||
+            (S->width[S->gen] == S->height[g] &&
+             S->height[S->gen] == S->width[g])));
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean no5c9(void) /* fcn */
+/* Don't allow change counts for gens 0-18 to be 1 3 3 5 6 4 4 4 3 1 ...
+   (the 5c/9 signal) to continue
+*/
+{ static int cycle[] = {1, 3, 3, 5, 6, 4, 4, 4, 3};
+  int i;
+
+  if (S->gen < 18)  return FALSE;
+  for (i=0; i<=18; i++)
+    if (S->chgcount[S->gen-i] != cycle[i%9])  return FALSE;
+  fprintf(S->out, "5c/9 continues too long\n");
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean persist(void)   /* fcn */
+/* All gen g changes in rows between var[132] and var[134] and columns
+   between var[133] and var[135] must also be present in gen g+var[111]
+*/
+{ point *p;
+
+  if (S->gen < S->var[111])  return FALSE;
+  for (p=S->chgd[S->gen-S->var[111]]; p<S->nays[S->gen-S->var[111]]; p++)
+    if (p->row >= S->var[132] && p->col >= S->var[133] &&
+        p->row <= S->var[134] && p->col <= S->var[135] &&
+        S->bkgd[p->row][p->col] == S->curr[p->row][p->col])
+      return TRUE;
+  return FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean mincount(void)  /* fcn */
+/* Lower bound on change count */
+{ return S->chgcount[S->gen] && S->chgcount[S->gen]<S->var[120];
+}
+
+/* -------------------------------------------------------------------- */
+
+/* The cellchecks are listed cheapest first, since none of them depends on
+   another.  The genchecks are in the order they've always been done in,
+   since some of them print messages.
+*/
+constraint constraints[] =
+  { {"rightspeed",    104, 0,   rightspeed, NULL,
+        "Force pattern to move right at >= 2c/3"},
+    {"downspeed",     105, 0,   downspeed, NULL,
+        "Force pattern to move down at >= 2c/3"},
+    {"downhalfspeed", 109, 0,   downhalfspeed, NULL,
+        "Force pattern to move down at >= c/2"},
+    {"diagwidth",     102, 0,   diagwidth, NULL,
+        "Bound diagonal width (NE to SW)"},
+    {"antidiagwidth", 103, 0,   antidiagwidth, NULL,
+        "Bound diagonal width (NW to SE)"},
+    {"norepeat",      107, 108, norepeat, NULL,
+        "No cell changed in 2 gens # to # apart"},
+    {"maxnew",        101, 0,   maxnew, NULL,
+        "Bound # of changes new since last gen"},
+    {"maxnewsince",   117, 118, maxnewsince, NULL,
+        "Bound # of changes new since # gens ago"},
+    {"maxagesum",     129, 0,   maxagesum, NULL,
+        "Bound sum of ages of changes"},
+    {"maxrunsum",     137, 138, maxrunsum, NULL,
+        "Bound sum of runs of repeated changes"},
+
+    {"maxtwos",       110, 0,   NULL, maxtwos,
+        "Allow change count 2 in at most # gens"},
+    {"notcount",      121, 122, NULL, notcount,
+        "In gen #, exclude change count #"},
+    {"startcount",    123, 124, NULL, startcount,
+        "Before gen #, require change count #"},
+    {NULL,            0,   0,   NULL, reqcount,
+        NULL},
+    {"samesize",      128, 0,   NULL, samesize,
+        "Same count & size as # gens ago"},
+    {"no5c9",         116, 0,   NULL, no5c9,
+        "Don't let the 5c/9 signal continue"},
+    {"persist",       111, 0,   NULL, persist,
+        "Changes in v132-v135 recur # gens on"},
+    {"mincount",      120, 0,   NULL, mincount,
+        "Lower bound on change count"},
+    {NULL}
+  };
+/* reqcount has no variable; it's enabled by the cc command. */
+
+/* -------------------------------------------------------------------- */
+
+void buildchecks(void)  /* fcn */
+/* Put the enabled constraints into the pipelines */
+{ constraint *con;
+  int nc, ng;
+
+  for (con=constraints, nc=ng=0; con->cellcheck || con->gencheck; con++)
+    if (con->var ? S->var[con->var] : S->numcc)
+      { if (con->cellcheck)  S->cellchecks[nc++] = con->cellcheck;
+        else                 S->genchecks[ng++] = con->gencheck;
+      }
+  S->cellchecks[nc] = NULL;
+  S->genchecks[ng] = NULL;
+}
+
+/* -------------------------------------------------------------------- */
+
+constraint *findconstraint(char *p) /* fcn */
+/* Return the constraint whose name is the first word of p, or NULL */
+{ constraint *con;
+  int n;
+
+  for (con=constraints; con->cellcheck || con->gencheck; con++)
+    if (con->name && !strncmp(p, con->name, n = strlen(con->name)) &&
+        (p[n] == ' ' || p[n] == '\0'))
+      return con;
+  return NULL;
+}
+
+/* -------------------------------------------------------------------- */
+
+char lookahead(void)    /* fcn */
+/* Called after settings made while computing gen.  The cells of gen
+   from nay on haven't been computed yet, but the next gen of some of
+   them may already be known.  Return ERR if those changes, together with
+   the ones already found, are too many or too spread out, or change a
+   DONTCHANGE cell; trycell would fail on them later anyway.  Changes
+   that only fail some of the time (var[100], var[112], var[113],
+   var[125], var[126]) aren't checked here.
+*/
+{ int r, c, count, minr, maxr, minc, maxc;
+  unsigned char val;
+  point *q;
+
+  if (S->gen < S->var[106])  return OK;
+
+  if (S->chg == S->chgd[S->gen])
+    { count = 0;
+      minr = S->HT;  minc = S->WD;  maxr = maxc = 0;
+    }
+  else
+    { count = S->chgstat.count;
+      minr = S->chgstat.minr;  maxr = S->chgstat.maxr;
+      minc = S->chgstat.minc;  maxc = S->chgstat.maxc;
+    }
+
+  for (q=S->nay; q<S->chgd[S->gen]; q++)
+    { r = q->row;  c = q->col;
+      val = S->var[136] ? jfnxgen(r,c) : nxgen(r,c);
+      if (val == UNK || val == S->bkgd[r][c])  continue;
+      if (S->flag[r][c] & DONTCHANGE)  return ERR;
+      if (S->flag[r][c] & DONTCOUNT)  continue;
+      count++;
+      minr = min(minr, r);  maxr = max(maxr, r);
+      minc = min(minc, c);  maxc = max(maxc, c);
+    }
+
+  if (S->gen < S->numcc || !count)  return OK;
+  if (count > S->maxchng && !S->var[100])  return ERR;
+  if (maxr-minr >= S->maxheight && !S->var[112] && !S->var[125])  return ERR;
+  if (maxc-minc >= S->maxwidth && !S->var[113] && !S->var[126])  return ERR;
+  return OK;
+}
+
+/* -------------------------------------------------------------------- */
+
+char trycell(void)  /* fcn */
+/* Given gen>0, nays[gen-1] <= nay < chgd[gen] <= chg.
+   Tries to compute next gen of cell specified by nay, possibly setting
+   bkgd of its neighbors to ON or OFF.  Returns ERR if problem occurs, in
+   which case we must back up.
+*/
+{ int r,c,g,qr,qc,minqr,maxqr,minqc,maxqc,ru,cu,forced;
+  unsigned char val;
+  point *q;
+  chgstats *st;
+  boolean isfree, recentbig,recentwide,recenttall;
+  boolean (**check)(int r, int c);
+
+  r = S->nay->row;  c = S->nay->col;
+
+#if COUNT
+  S->counttrycell++;
+  if (TRACE)  {fprintf(S->out, " trycell()\n");fflush(S->out);}
+#endif
+
+  while ((val = S->var[136] ? jfnxgen(r,c) : nxgen(r,c)) == UNK)
+    { if ((forced = choosecell(r,c,&ru,&cu)) >= 0)
+        { if (proceed(ru,cu,forced,0))  return ERR;
+          if (S->LOOKAHEAD && lookahead())  return ERR;
+          continue;
+        }
+
+      S->nwstng->gen = S->gen;
+      S->nwstng->nay = S->nay;
+      S->nwstng->chg = S->chg;
+      S->settingstat[S->nwstng - S->settinglist] = S->chgstat;
+
+      if (S->forcedpos < S->forcedlth)	/* Replaying another thread's choices */
+        { val = S->forcedpath[S->forcedpos++];
+          isfree = FLIPPED;
+        }
+      else
+        { val = choosevalue(ru,cu);
+          isfree = TRUE;
+          S->countnodes++;
+        }
+      if (proceed(ru,cu,val,isfree))  return ERR;
+      if (S->LOOKAHEAD && lookahead())  return ERR;
+      if ((S->splitcount || S->splitdepth) && pruned())  return ERR;
+      if (isfree == FLIPPED && S->forcedpos == S->forcedlth)
+        { S->countreplay--;        /* Done replaying, so this call counts */
+          countcall();
+        }
     }
   
-  if (val == bkgd[r][c])  return OK;
+  if (val == S->bkgd[r][c])  return OK;
 
   /* Now we know that the cell is changed in the next generation, */
   /* so we perform some tests to see if that's permitted.         */
 
-  chg->row = r;  (chg++)->col = c;
-  if (chg-chglist>=CHGLISTLTH)					/* From Gabriel Nivasch */
+  S->chg->row = r;  S->chg->col = c;
+
+  /* Update the stats of the changes in this gen, to include this one */
+  if (S->gen < 64)  S->changedin[r][c] |= 1UL << S->gen;
+  st = &S->chgstat;
+  if (S->chg++ == S->chgd[S->gen])
+    { st->minr = S->HT;  st->minc = S->WD;  st->maxr = st->maxc = 0;
+      st->mindif = st->minsum = MAXHT+MAXWD;
+      st->maxdif = st->maxsum = -(MAXHT+MAXWD);
+      st->count = 0;
+    }
+  if (!(S->flag[r][c] & DONTCOUNT))
+    { st->minr = min(st->minr, r);  st->maxr = max(st->maxr, r);
+      st->minc = min(st->minc, c);  st->maxc = max(st->maxc, c);
+      st->mindif = min(st->mindif, r-c);  st->maxdif = max(st->maxdif, r-c);
+      st->minsum = min(st->minsum, r+c);  st->maxsum = max(st->maxsum, r+c);
+      st->count++;
+    }
+
+  if (S->chg-S->chglist>=CHGLISTLTH)			/* From Gabriel Nivasch */
     err("Overflow of chglist at trycell().\n")	/* From Gabriel Nivasch */
 
 
   /* Test for failure, based on active region getting too big. */
 
-  if (gen < var[106])  return OK;
+  if (S->gen < S->var[106])  return OK;
 
-  if (flag[r][c] & DONTCHANGE)  return ERR;
+  if (S->flag[r][c] & DONTCHANGE)  return ERR;
 
-  if (flag[r][c] & DONTCOUNT)  return OK;
+  if (S->flag[r][c] & DONTCOUNT)  return OK;
 
   recentbig = recentwide = recenttall = TRUE;
-  if (var[100])
-	for (g=gen-1; g>=0 && g>gen-var[100]; g--)
-	  if (chgcount[g] <= maxchng)		{ recentbig = FALSE; break; }
+  if (S->var[100])
+	for (g=S->gen-1; g>=0 && g>S->gen-S->var[100]; g--)
+	  if (S->chgcount[g] <= S->maxchng)		{ recentbig = FALSE; break; }
   /* recentbig is TRUE if chgcount too large for last var[100]-1 gens */
 
-  if (var[125])
-	for (g=gen-1; g>=0 && g>gen-var[125]; g--)
-	  if (height[g] <= maxheight)			{ recenttall = FALSE; break; }
+  if (S->var[125])
+	for (g=S->gen-1; g>=0 && g>S->gen-S->var[125]; g--)
+	  if (S->height[g] <= S->maxheight)			{ recenttall = FALSE; break; }
   /* recenttall is TRUE if height too large for last var[125]-1 gens */
 
-  if (var[126])
-	for (g=gen-1; g>=0 && g>gen-var[126]; g--)
-	  if (width[g] <= maxwidth)			{ recentwide = FALSE; break; }
+  if (S->var[126])
+	for (g=S->gen-1; g>=0 && g>S->gen-S->var[126]; g--)
+	  if (S->width[g] <= S->maxwidth)			{ recentwide = FALSE; break; }
   /* recentwide is TRUE if width too large for last var[126]-1 gens */
 
-  /* Find min & max row & column of changed cells. */
-  for (q=chgd[gen], minqr=HT, minqc=WD, maxqr=maxqc=0; q<chg; q++)
-    { qr = q->row;  qc = q->col;
-      if (flag[qr][qc] & DONTCOUNT)  continue;
-	  if (qr < minqr)  minqr=qr;
-	  if (qr > maxqr)  maxqr=qr;
-	  if (qc < minqc)  minqc=qc;
-	  if (qc > maxqc)  maxqc=qc;
-	}
+  /* Min & max row & column of changed cells */
+  minqr = st->minr;  maxqr = st->maxr;
+  minqc = st->minc;  maxqc = st->maxc;
 
   /* Make sure changed region isn't too tall */
-  if (var[112])
-	{ for (q=chgd[gen]; q<chg-1; q++)
-		if ((qr = q->row) >= minqr+maxheight && qr <= maxqr-maxheight)
+  if (S->var[112])
+	{ for (q=S->chgd[S->gen]; q<S->chg-1; q++)
+		if ((qr = q->row) >= minqr+S->maxheight && qr <= maxqr-S->maxheight)
 		  return ERR;
 	}
   else
-	if (maxqr-minqr >= maxheight && recenttall && gen>=numcc)  return ERR;
+	if (maxqr-minqr >= S->maxheight && recenttall && S->gen>=S->numcc)
+	  return ERR;
 	
   /* Make sure changed region isn't too wide */
-  if (var[113])
-	{ for (q=chgd[gen]; q<chg-1; q++)
-		if ((qc = q->col) >= minqc+maxwidth && qc <= maxqc-maxwidth)
+  if (S->var[113])
+	{ for (q=S->chgd[S->gen]; q<S->chg-1; q++)
+		if ((qc = q->col) >= minqc+S->maxwidth && qc <= maxqc-S->maxwidth)
 		  return ERR;
 	}
   else
-	if (maxqc-minqc >= maxwidth && recentwide && gen>=numcc)  return ERR;
-
-  for (q=chgd[gen], changecount=1; q<chg-1; q++)
-    { qr = q->row;  qc = q->col;
-      if (flag[qr][qc] & DONTCOUNT)  continue;
-      if (++changecount > maxchng && recentbig && gen>=numcc)  return ERR;
-
-      /* Put bounds on bounding diamond */
-      if ((var[102] && diff(r-c,qr-qc) >= var[102]) ||
-		  (var[103] && diff(r+c,qr+qc) >= var[103]))
-        return ERR;
-    }
-
-  if (var[107])			/* Don't allow cell to be changed in 2 gens */
-						/* between var[107] and var[108] gens apart */
-	for (g=gen-var[107]; g>=gen-var[108] && g>=0; g--)
-	  for (q=chgd[g]; q<nays[g]; q++)
-	    if (q->row == r && q->col == c)  return ERR;
-
-/* Put bound on number of changed cells that weren't changed last gen */
-  if (var[101] && gen > 0)
-	for (q=chgd[gen], changecount=0; q<chg; q++)
-	  { qr = q->row;  qc = q->col;
-		for (qm=chgd[gen-1], oldchange=FALSE; qm<nays[gen-1]; qm++)
-		  if (qm->row == qr && qm->col == qc)
-			{ oldchange = TRUE;		/* Change isn't new, so don't count it */
-			  break;
-			}
-		if (!oldchange)  changecount++;
-		if (changecount > var[101])  return ERR;
-	  }
-
-/* Put bound on # of changed cells that weren't changed var[118] gens ago */
-  if (var[117] && gen >= var[118])
-	for (q=chgd[gen], changecount=0; q<chg; q++)
-	  { qr = q->row;  qc = q->col;
-		for (qm=chgd[gen-var[118]], oldchange=FALSE;
-			 qm<nays[gen-var[118]];
-			 qm++)
-		  if (qm->row == qr && qm->col == qc)
-			{ oldchange = TRUE;		/* Change isn't new, so don't count it */
-			  break;
-			}
-		if (!oldchange)  changecount++;
-		if (changecount > var[117])  return ERR;
-	  }
-
-/* Bound sum of ages of all changes */
-  if (var[129])
-    { for (g=0; g<gen; g++)
-        for (qm=chgd[g]; qm<nays[g]; qm++)
-          if (qm->row == r && qm->col == c)
-            goto FOUNDFIRST;
-
-    FOUNDFIRST:
-      agesm[gen] += gen-g+1;
-      if (agesm[gen] > var[129])  return ERR;
-    }
-
-#if 0
-/* Bound sum of # of consec gens in which cell has been changed.  6/27/2008 */
-  if (var[137])
-    { for (q=chgd[gen], agesum=0; q<chg; q++)
-	    { qr = q->row;  qc = q->col;
-/* printf("gen=%d  qr=%d  qc=%d  agesum=%d  var[137]=%d\n",gen,qr,qc,agesum,var[137]); */
-		  if (++agesum > var[137])    /* Count change in current gen */
-		    return ERR;
-		  for (g=gen-1; g>=0; g--)
-		    { 
-/*printf("gen=%d g=%d agesum=%d\n",gen,g,agesum); */
-			  for (qm=chgd[g]; qm<nays[g]; qm++)
-			    if (qm->row == qr && qm->col == qc)
-				  goto CHANGEDING;
-			  break;
-
-			CHANGEDING:
-/*printf("CHANGEDING:  gen=%d  g=%d  qr=%d  qc=%d  agesum was %d\n",gen,g,qr,qc,agesum); */
-			  if (++agesum > var[137])  return ERR;
-			}
-		}
-	}
-#endif
-
-/* Bound sum of # of consec gens in which cell has been changed.  6/27/2008 */
-  if (var[137])
-    { for (q=chgd[gen], agesum=0; q<chg; q++)
-	    { qr = q->row;  qc = q->col;
-		  pgen = gen;  /* Earliest generation in "consecutive" */
-		               /* group in which cell changed          */
-		  for (g=gen-1; g>=0 && g>=pgen-var[138]-1; g--)
-		    for (qm=chgd[g]; qm<nays[g]; qm++)
-			  if (qm->row == qr && qm->col == qc)
-				{ pgen = g;
-				  break;
-				}
-
-		  agesum += gen-pgen+1;
-		  if (agesum > var[137])  return ERR;
-		}
-	}
-
-/* Force signal to move right at >= 2c/3 */
-  if (var[104] && 3*c < 2*gen + var[104])  return ERR;
+	if (maxqc-minqc >= S->maxwidth && recentwide && S->gen>=S->numcc)
+	  return ERR;
 
-/* Force signal to move down at >= 2c/3 */
-  if (var[105] && 3*r < 2*gen + var[105])  return ERR;
+  if (st->count > S->maxchng && recentbig && S->gen>=S->numcc)
+    return ERR;
 
-/* Force signal to move down at >= c/2 */
-  if (var[109] && 2*r < gen + var[109])  return ERR;
+  for (check=S->cellchecks; *check; check++)
+    if ((*check)(r,c))  return ERR;
 
   return OK;
 }
@@ -929,52 +2127,48 @@ char computecellorbackup(void)  /* fcn */
    possibly decreasing gen, nay, and chg.  If can't back up, returns ERR,
    in which case no more objects exist.
 */
-{ static setting *wasfree;
-  static int g,qr,qc;
-  static point *q, *qm;
+{ setting *wasfree;
+  point *q;
+  boolean found;
 
-  if (++countcomporbackuplo == 1000000)
-    { countcomporbackuplo = 0;
-	  countcomporbackuphi++;
-	}
+  if (S->forcedpos < S->forcedlth)  S->countreplay++;
+  else                              countcall();
 
 #if COUNT
-  if (TRACE)  {printf("computecellorbackup()\n");fflush(stdout);}
+  if (TRACE)  {fprintf(S->out, "computecellorbackup()\n");fflush(S->out);}
 #endif
 
-  if (!found &&
-      !(var[139] && (chgd[gen]-nays[gen-1])>var[139]) &&
+  if (!S->found &&
+      !(S->var[139] && (S->chgd[S->gen]-S->nays[S->gen-1])>S->var[139]) &&
 	  trycell()==OK)
-    { nay++;
+    { S->nay++;
       return OK;
     }
 
-  changecurr(curr, gen-1);  /* curr <- bkgd */
-  found = FALSE;
+  changecurr(S->curr, S->gen-1);  /* curr <- bkgd */
+  found = S->found;
+  S->found = FALSE;
 
-  if (backup())  return ERR;
+  do
+    { if (backup())  return ERR;
 
-  if (go(nwstng->row, nwstng->col, !nwstng->val, 0, &wasfree))
-    return ERR;
-  
-  gen = wasfree->gen;
-  nay = wasfree->nay;
-  chg = wasfree->chg;
-  changecurr(curr, gen-1);
+      if (go(S->nwstng->row, S->nwstng->col, !S->nwstng->val, FLIPPED,
+             &wasfree))
+        return ERR;
+    }
+  while ((S->splitcount || S->splitdepth) && pruned());
 
-  /* Recompute value of agesm[gen] */
-  if (var[129])
-    { for (q=chgd[gen], agesm[gen]=0; q<chg; q++)
-        { qr = q->row;  qc = q->col;
-          for (g=0; g<gen; g++)
-            for (qm=chgd[g]; qm<nays[g]; qm++)
-              if (qm->row == qr && qm->col == qc)
-                goto FOUNDFIRST;
+  unmarkchanges(wasfree->chg, found);
+  S->gen = wasfree->gen;
+  S->nay = wasfree->nay;
+  S->chg = wasfree->chg;
+  S->chgstat = S->settingstat[wasfree - S->settinglist];
+  changecurr(S->curr, S->gen-1);
 
-        FOUNDFIRST:
-          agesm[gen] += gen-g+1;
-        }
-    }
+  /* Recompute value of agesm[gen] */
+  if (S->var[129])
+    for (q=S->chgd[S->gen], S->agesm[S->gen]=0; q<S->chg; q++)
+      S->agesm[S->gen] += S->gen-firstchange(q->row, q->col, S->gen)+1;
 
   return OK;
 }
@@ -988,16 +2182,16 @@ int period(void)    /* fcn */
 /* Checks to see if changes in generation gen are the same as in some
    previous generation.  If so, returns period.  Otherwise, returns 0.
 */
-{ static int g, numchgs;
-  static point *q;
+{ int g, numchgs;
+  point *q;
 
-  numchgs = nays[gen] - chgd[gen];
+  numchgs = S->nays[S->gen] - S->chgd[S->gen];
 
-  for (g=gen-1; g>=0; g--)
-    { if (nays[g] - chgd[g] != numchgs)  continue;
-      for (q=chgd[g]; q<nays[g]; q++)
-        if (curr[q->row][q->col] == bkgd[q->row][q->col])  break;
-      if (q==nays[g])  return gen-g;
+  for (g=S->gen-1; g>=0; g--)
+    { if (S->nays[g] - S->chgd[g] != numchgs)  continue;
+      for (q=S->chgd[g]; q<S->nays[g]; q++)
+        if (S->curr[q->row][q->col] == S->bkgd[q->row][q->col])  break;
+      if (q==S->nays[g])  return S->gen-g;
     }
   
   return 0;
@@ -1011,38 +2205,38 @@ void dispchgcts(int g) /* fcn */
 
   different=FALSE;
   for (i=0; i<=g; i++)
-    if (nays[i]-chgd[i] != chgcount[i]) different = TRUE;
+    if (S->nays[i]-S->chgd[i] != S->chgcount[i]) different = TRUE;
 
   if (different)
-    { printf("Full change counts:");
+    { fprintf(S->out, "Full change counts:");
       for (i=0; i<=g; i++)
-	    { if (i && i%5 == 0)  printf(" ");
-	      printf(" %d",nays[i]-chgd[i]);
+	    { if (i && i%5 == 0)  fprintf(S->out, " ");
+	      fprintf(S->out, " %d",(int) (S->nays[i]-S->chgd[i]));
 	    }
-      printf("\n");
+      fprintf(S->out, "\n");
 	}
 
-  printf("Change counts:");
+  fprintf(S->out, "Change counts:");
   for (i=0; i<=g; i++)
-	{ if (i && i%5 == 0)  printf(" ");
-	  printf(" %d",chgcount[i]);
+	{ if (i && i%5 == 0)  fprintf(S->out, " ");
+	  fprintf(S->out, " %d",S->chgcount[i]);
 	}
-  printf("\n");
+  fprintf(S->out, "\n");
 
-  printf("Sizes:");
+  fprintf(S->out, "Sizes:");
   for (i=0; i<=g; i++)
-	{ if (i && i%5 == 0)  printf(" ");
-	  printf(" %dx%d",height[i],width[i]);
+	{ if (i && i%5 == 0)  fprintf(S->out, " ");
+	  fprintf(S->out, " %dx%d",S->height[i],S->width[i]);
 	}
-  printf("\n");
+  fprintf(S->out, "\n");
 
-  if (var[129])
-    { printf("Age sums:");
+  if (S->var[129])
+    { fprintf(S->out, "Age sums:");
       for (i=0; i<=g; i++)
-	    { if (i && i%5 == 0)  printf(" ");
-	      printf(" %d",agesm[i]);
+	    { if (i && i%5 == 0)  fprintf(S->out, " ");
+	      fprintf(S->out, " %d",S->agesm[i]);
 	    }
-      printf("\n");
+      fprintf(S->out, "\n");
 	}
 }
 
@@ -1050,66 +2244,82 @@ void dispchgcts(int g) /* fcn */
 
 void display(int g) /* fcn */
 /* Print non-UNK part of bkgd and gen g. */
-{ static int r,c,minr,maxr,minc,maxc,lastc;
-  static boolean changed;
-  static point *p;
+{ int r,c,minr,maxr,minc,maxc,lastc;
+  boolean changed;
+  point *p;
+  setting *st;
 
-  if (NOPICS)
-    { printf("\n");
+  if (S->NOPICS)
+    { fprintf(S->out, "\n");
 	  return;
 	}
 
-  minr = HT;    maxr = -1;
-  minc = WD;    maxc = -1;
+  minr = S->HT;    maxr = -1;
+  minc = S->WD;    maxc = -1;
 
   /* Find bounding box of union of ON part of bkgd */
-  /* and set of changed cells in gen g. */
-  for (r=2; r<HT-2; r++)
-    for (c=2; c<WD-2; c++)
-      if (bkgd[r][c] == ON)
-        { if (r<minr)  minr = r;
-          if (r>maxr)  maxr = r;
-          if (c<minc)  minc = c;
-          if (c>maxc)  maxc = c;
-        }
-  for (p=chgd[g]; p<nays[g]; p++)
+  /* and set of changed cells in gen g.  Once the  */
+  /* search has started, the ON cells are the ones */
+  /* in the start box and those in settinglist.   */
+  if (S->started)
+    { minr = S->startminr;  maxr = S->startmaxr;
+      minc = S->startminc;  maxc = S->startmaxc;
+      for (st=S->settinglist; st<S->nwstng; st++)
+        if (st->val == ON)
+          { if (st->row<minr)  minr = st->row;
+            if (st->row>maxr)  maxr = st->row;
+            if (st->col<minc)  minc = st->col;
+            if (st->col>maxc)  maxc = st->col;
+          }
+    }
+  else
+    for (r=2; r<S->HT-2; r++)
+      for (c=2; c<S->WD-2; c++)
+        if (S->bkgd[r][c] == ON)
+          { if (r<minr)  minr = r;
+            if (r>maxr)  maxr = r;
+            if (c<minc)  minc = c;
+            if (c>maxc)  maxc = c;
+          }
+  for (p=S->chgd[g]; p<S->nays[g]; p++)
     { if (p->row < minr)  minr = p->row;
       if (p->row > maxr)  maxr = p->row;
       if (p->col < minc)  minc = p->col;
       if (p->col > maxc)  maxc = p->col;
     }
 
-  if (maxr<0)  { minr=maxr=HT/2;  minc=maxc=WD/2; }
+  if (maxr<0)  { minr=maxr=S->HT/2;  minc=maxc=S->WD/2; }
   minr-=2;  maxr+=2;  minc-=2;  maxc+=2;
-  printf("Gen %d.  Rows %d - %d.  Cols %d - %d.\n",g,minr,maxr,minc,maxc);
+  fprintf(S->out, "Gen %d.  Rows %d - %d.  Cols %d - %d.\n",
+    g,minr,maxr,minc,maxc);
 
   for (r=minr; r<=maxr; r++)
     { for (lastc=maxc; lastc>minc; lastc--)
-        if (bkgd[r][lastc] != UNK)  break;
+        if (S->bkgd[r][lastc] != UNK)  break;
 
       for (c=minc; c<=lastc; c++)
-        { if (bkgd[r][c] != UNK)
-            for (p=chgd[g], changed=FALSE; p<nays[g]; p++)
+        { if (S->bkgd[r][c] != UNK)
+            for (p=S->chgd[g], changed=FALSE; p<S->nays[g]; p++)
               if (p->row == r && p->col == c)
                 { changed = TRUE;
                   break;
                 }
 
-          printf("%c", bkgd[r][c]==OFF ? (changed ? '1' : '.') :
-                       bkgd[r][c]==ON  ? (changed ? '0' : 'o') :
+          fprintf(S->out, "%c", S->bkgd[r][c]==OFF ? (changed ? '1' : '.') :
+                       S->bkgd[r][c]==ON  ? (changed ? '0' : 'o') :
                        ',');
         }
-      printf("\n");
+      fprintf(S->out, "\n");
     }
   
-  fflush(stdout);
+  fflush(S->out);
 }
 
 /* -------------------------------------------------------------------- */
 
 enum {NWR, NER, SWR, SER, NWC, NEC, SWC, SEC};
 
-void getrotordesc(unsigned char cell[][MAXWD], int period,  /* fcn */
+void getrotordesc(unsigned char **cell, int period,  /* fcn */
   int minr, int maxr, int minc, int maxc, int orientation,  /* fcn */
   char *string) /* fcn */
 /* Given description of bounding box of rotor in one generation, in
@@ -1165,14 +2375,14 @@ void getrotordesc(unsigned char cell[][MAXWD], int period,  /* fcn */
       { if (cell[r][c] == STATOR)  *p = '.';
         else
           { *p = cell[r][c] ? '@' : '0';
-            if (cell[r-1][c-1] == STATOR)  *p += curr[r-1][c-1];
-            if (cell[r-1][c  ] == STATOR)  *p += curr[r-1][c  ];
-            if (cell[r-1][c+1] == STATOR)  *p += curr[r-1][c+1];
-            if (cell[r  ][c-1] == STATOR)  *p += curr[r  ][c-1];
-            if (cell[r  ][c+1] == STATOR)  *p += curr[r  ][c+1];
-            if (cell[r+1][c-1] == STATOR)  *p += curr[r+1][c-1];
-            if (cell[r+1][c  ] == STATOR)  *p += curr[r+1][c  ];
-            if (cell[r+1][c+1] == STATOR)  *p += curr[r+1][c+1];
+            if (cell[r-1][c-1] == STATOR)  *p += S->curr[r-1][c-1];
+            if (cell[r-1][c  ] == STATOR)  *p += S->curr[r-1][c  ];
+            if (cell[r-1][c+1] == STATOR)  *p += S->curr[r-1][c+1];
+            if (cell[r  ][c-1] == STATOR)  *p += S->curr[r  ][c-1];
+            if (cell[r  ][c+1] == STATOR)  *p += S->curr[r  ][c+1];
+            if (cell[r+1][c-1] == STATOR)  *p += S->curr[r+1][c-1];
+            if (cell[r+1][c  ] == STATOR)  *p += S->curr[r+1][c  ];
+            if (cell[r+1][c+1] == STATOR)  *p += S->curr[r+1][c+1];
           }
       }
 
@@ -1181,52 +2391,225 @@ void getrotordesc(unsigned char cell[][MAXWD], int period,  /* fcn */
 
 /* -------------------------------------------------------------------- */
 
-unsigned long int newhash(unsigned long int hash,   /* fcn */
-                          unsigned long int update) /* fcn */
-{ return 31*hash+update;
+unsigned long int mix(unsigned long int x)  /* fcn */
+/* Scramble the bits of x */
+{ x ^= x >> 30;  x *= 0xbf58476d1ce4e5b9UL;
+  x ^= x >> 27;  x *= 0x94d049bb133111ebUL;
+  return x ^ (x >> 31);
 }
 
 /* -------------------------------------------------------------------- */
 
-unsigned long int hash(void)    /* fcn */
-/* Computes hash function based on list of changes in gens 0 to gen */
-{ static int g;
-  static point *q;
-  static unsigned long int h;
+fingerprint canonhash(void) /* fcn */
+/* Like hash(), but the same for all translations, reflections and
+   rotations of the changes.  For each of the 8 symmetries of the square,
+   the changes are transformed and moved so that the top left corner of
+   the box around the gen 0 changes is at (0,0); the order of the
+   changes within a gen doesn't matter.  The smallest of the 8
+   fingerprints is used.
+*/
+{ static const int sym[8][4] = { {1,0,0,1}, {1,0,0,-1}, {-1,0,0,1},
+    {-1,0,0,-1}, {0,1,1,0}, {0,1,-1,0}, {0,-1,1,0}, {0,-1,-1,0} };
+  const int *m;
+  int t, g, r, c, minr, minc;
+  point *q;
+  unsigned long int x, sum0, sum1;
+  fingerprint h, best;
+
+  best.lo = best.hi = ~0UL;
+  for (t=0; t<8; t++)
+    { m = sym[t];
+      minr = minc = 2*(MAXHT+MAXWD);
+      for (q=S->chgd[0]; q<S->nays[0]; q++)
+        { minr = min(minr, m[0]*q->row + m[1]*q->col);
+          minc = min(minc, m[2]*q->row + m[3]*q->col);
+        }
+      h.lo = h.hi = 0;
+      for (g=0; g<=S->gen; g++)
+        { for (q=S->chgd[g], sum0=sum1=0; q<S->nays[g]; q++)
+            { r = m[0]*q->row + m[1]*q->col - minr;
+              c = m[2]*q->row + m[3]*q->col - minc;
+              x = (unsigned long int) (r + 2*MAXHT) << 32 | (c + 2*MAXWD);
+              sum0 += mix(x);
+              sum1 += mix(x ^ 0x5555555555555555UL);
+            }
+          h.lo = mix(h.lo ^ sum0) + g;
+          h.hi = mix(h.hi + sum1) ^ (S->nays[g] - S->chgd[g]);
+        }
+      if (h.hi < best.hi || (h.hi == best.hi && h.lo < best.lo))
+        best = h;
+    }
+  if (!best.lo && !best.hi)  best.lo = 1;
+  return best;
+}
+
+/* -------------------------------------------------------------------- */
 
-  for (g=h=0; g<=gen; g++)
-    for (q=chgd[g]; q<nays[g]; q++)
-      h = newhash(newhash(h,q->row), q->col);
+fingerprint hash(void)  /* fcn */
+/* Computes a 128-bit fingerprint of the list of changes in gens 0 to
+   gen.  The end of each gen's list is included, so that histories
+   that differ only in when the changes happened don't collide.
+*/
+{ int g;
+  point *q;
+  unsigned long int x;
+  fingerprint h;
+
+  if (S->CANONHASH)  return canonhash();
+  h.lo = h.hi = 0;
+  for (g=0; g<=S->gen; g++)
+    { for (q=S->chgd[g]; q<S->nays[g]; q++)
+        { x = (unsigned long int) q->row*MAXWD + q->col + 1;
+          h.lo = (h.lo ^ x) * 0x100000001b3UL;
+          h.hi = (h.hi + x) * 0x9e3779b97f4a7c15UL;
+          h.hi ^= h.hi >> 31;
+        }
+      h.lo = (h.lo ^ 0xffff) * 0x100000001b3UL;
+      h.hi = (h.hi + 0xffff) * 0x9e3779b97f4a7c15UL;
+      h.hi ^= h.hi >> 31;
+    }
+  if (!h.lo && !h.hi)  h.lo = 1;
   return h;
 }
 
 /* -------------------------------------------------------------------- */
 
-unsigned long int hashtable[HASHTBLSIZE];
-int hashcount;
+long int hashslot(fingerprint h)    /* fcn */
+/* Return the slot where h is, or the empty slot where it would go. */
+{ long int i;
+  fingerprint *t = S->master->hashtable;
 
-char hashnew(unsigned long int h)   /* fcn */
-/* Look up h in hashtable.  If found, return FALSE.  If not, add to
-   table and return TRUE.
+  for (i=h.lo & (S->master->hashsize-1); t[i].lo || t[i].hi;
+       i = (i+1) & (S->master->hashsize-1))
+    if (t[i].lo == h.lo && t[i].hi == h.hi)  break;
+  return i;
+}
+
+/* -------------------------------------------------------------------- */
+
+void hashinit(searchstate *m, long int size)    /* fcn */
+/* Make m's hash table empty, with size slots. */
+{ free(m->hashtable);
+  if (!(m->hashtable = calloc(size, sizeof(fingerprint))))
+    err("Out of memory for hash table");
+  m->hashsize = size;
+  m->hashcount = 0;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean hashgrow(void)  /* fcn */
+/* Double the size of the hash table.  Return FALSE if there's no memory
+   for it (it's called with hashlock held, so it can't call err).
 */
-{ int i;
+{ searchstate *m = S->master;
+  fingerprint *old = m->hashtable;
+  long int i, oldsize = m->hashsize, count = m->hashcount;
+
+  if (!(m->hashtable = calloc(2*oldsize, sizeof(fingerprint))))
+    { m->hashtable = old;
+      return FALSE;
+    }
+  m->hashsize = 2*oldsize;
+  for (i=0; i<oldsize; i++)
+    if (old[i].lo || old[i].hi)
+      m->hashtable[hashslot(old[i])] = old[i];
+  m->hashcount = count;
+  free(old);
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+char hashnew(fingerprint h) /* fcn */
+/* Look up h in hashtable.  If found, return FALSE.  If not, add to
+   table and return TRUE.
+*/
+{ long int i;
+  boolean isnew, grown = TRUE;
+  searchstate *m = S->master;
 
 #if COUNT
-if (TRACE) {printf("hashnew(%lx).  hashcount = %d\n", h,hashcount);fflush(stdout);}
+if (TRACE) {fprintf(S->out, "hashnew(%lx%016lx).  hashcount = %ld\n",
+             h.hi,h.lo,m->hashcount);fflush(S->out);}
+#endif
+
+#if THREADS
+  pthread_mutex_lock(&m->hashlock);
+#endif
+  i = hashslot(h);
+  m->hashlookups++;
+  m->hashprobes += ((i - (long int) h.lo) & (m->hashsize-1)) + 1;
+  if ((isnew = !(m->hashtable[i].lo || m->hashtable[i].hi)))
+    { m->hashtable[i] = h;
+      if (++m->hashcount > m->hashsize/2)  grown = hashgrow();
+    }
+#if THREADS
+  pthread_mutex_unlock(&m->hashlock);
 #endif
+  if (!grown)  err("Out of memory for hash table");
+  return isnew;
+}
 
-  for (i=0; i<hashcount; i++)
-    if (h == hashtable[i])
-	  return FALSE;
+/* -------------------------------------------------------------------- */
 
-  hashtable[hashcount++] = h;
-  if (hashcount>=HASHTBLSIZE)  err("Hash table overflow");
-  return TRUE;
+void hashforget(fingerprint h)  /* fcn */
+/* Remove h from hashtable.  The entries after it in its run of full
+   slots are moved back if need be, so that they can still be found.
+*/
+{ long int i, j, k, mask;
+  fingerprint *t;
+
+#if THREADS
+  pthread_mutex_lock(&S->master->hashlock);
+#endif
+  t = S->master->hashtable;
+  mask = S->master->hashsize-1;
+  i = hashslot(h);
+  if (t[i].lo || t[i].hi)
+    { S->master->hashcount--;
+      for (j=(i+1)&mask; t[j].lo || t[j].hi; j=(j+1)&mask)
+        { k = t[j].lo & mask;   /* Where t[j] would like to be */
+          if (((j-k)&mask) >= ((j-i)&mask))
+            { t[i] = t[j];
+              i = j;
+            }
+        }
+      t[i].lo = t[i].hi = 0;
+    }
+#if THREADS
+  pthread_mutex_unlock(&S->master->hashlock);
+#endif
+}
+
+/* -------------------------------------------------------------------- */
+
+unsigned int knownhash(char *desc)  /* fcn */
+/* Hash function for rotor descriptors, used to index the known rotors */
+{ unsigned int h;
+
+  for (h=2166136261U; *desc; desc++)
+    h = (h ^ (unsigned char) *desc) * 16777619U;
+  return h;
+}
+
+/* -------------------------------------------------------------------- */
+
+int findknown(knownrotors *k, char *desc)   /* fcn */
+/* Return the index in k->rotor of the first known rotor whose
+   descriptor is desc, or -1 if there's none.
+*/
+{ unsigned int j;
+  int i;
+
+  for (j=knownhash(desc); (i=k->index[j & (KNOWNHASHSIZE-1)]); j++)
+    if (strcmp(k->rotor[i-1], desc) == 0)  return i-1;
+  return -1;
 }
 
 /* -------------------------------------------------------------------- */
 
-void fillcell(unsigned char cell[][MAXWD], int mingen, int maxgen,	/* fcn */
+void fillcell(unsigned char **cell, int mingen, int maxgen,	/* fcn */
 			  int *minr, int *maxr, int *minc, int *maxc)			/* fcn */
 /* Make cell describe the rotor from generation mingen to generation
    maxgen.  I.e. a cell that has the same value in all of those generations
@@ -1234,31 +2617,41 @@ void fillcell(unsigned char cell[][MAXWD], int mingen, int maxgen,	/* fcn */
    mingen.  Set minr, maxr, minc, and maxc to the min and max row and column
    of the rotor.
 */
-{ static point *q0, *q1;
-  static int g0, g1, count, r, c;
-
-  /* Fill cell with STATOR cells */
-  for (r=0; r<WD; r++)  for (c=0; c<HT; c++)  cell[r][c] = STATOR;
+{ point *q0, *q1;
+  int g0, g1, count, r, c;
+
+  /* Fill cell with STATOR cells, around all the changes so far.  Nothing
+     outside that is looked at. */
+  *minr = S->HT;  *maxr = -1;
+  *minc = S->WD;  *maxc = -1;
+  for (g0=0; g0<=S->gen; g0++)
+    for (q0=S->chgd[g0]; q0<S->nays[g0]; q0++)
+      { *minr = min(*minr, q0->row);  *maxr = max(*maxr, q0->row);
+        *minc = min(*minc, q0->col);  *maxc = max(*maxc, q0->col);
+      }
+  for (r=*minr-1; r<=*maxr+1; r++)
+    for (c=*minc-1; c<=*maxc+1; c++)
+      cell[r][c] = STATOR;
 
-  *minr = HT;  *maxr = -1;
-  *minc = WD;  *maxc = -1;
+  *minr = S->HT;  *maxr = -1;
+  *minc = S->WD;  *maxc = -1;
 
   /* For each cell that's changed in some gen, count how many gens it's */
   /* changed in.  If it's changed in all gens, it's not in rotor.       */
   for (g0=mingen; g0<=maxgen; g0++)
-    for (q0=chgd[g0]; q0<nays[g0]; q0++)
+    for (q0=S->chgd[g0]; q0<S->nays[g0]; q0++)
       { r = q0->row;  c = q0->col;
         count = 0;
         for (g1=mingen; g1<=maxgen; g1++)
-          for (q1=chgd[g1]; q1<nays[g1]; q1++)
+          for (q1=S->chgd[g1]; q1<S->nays[g1]; q1++)
             if (q1->row == r && q1->col == c)
               { if (g1<g0)  goto NOTFIRSTOCCURRENCE;
                 count++;
               }
         if (count < maxgen-mingen+1)
           { /* Found another rotor cell */
-            cell[r][c] = bkgd[r][c];
-			for (q1=chgd[mingen]; q1<nays[mingen]; q1++)
+            cell[r][c] = S->bkgd[r][c];
+			for (q1=S->chgd[mingen]; q1<S->nays[mingen]; q1++)
 			  if (q1->row == r && q1->col == c)  cell[r][c] ^= 1;
 
             if (r < *minr)  *minr = r;
@@ -1277,22 +2670,22 @@ void printoscinfo(int p, char prefix)  /* fcn */
    If prefix is 'f', 's', or 'u', then print info about the entire Life
    history of the object, starting at gen 0.
 */
-{ static point *q0, *q1;
-  static int g0, g1, count, r, c, rotorsize, i, minr,maxr,minc,maxc,
+{ point *q0, *q1;
+  int g0, g1, count, r, c, rotorsize, i, minr,maxr,minc,maxc,
     orientation,minorient,maxorient,g, dist, changesome, unconcount, rn, cn;
-  static char rotordesc[MAXROTORDESCLTH], minrotordesc[MAXROTORDESCLTH];
-  static unsigned char cell[MAXHT][MAXWD];
-  static boolean known;
+  char rotordesc[MAXROTORDESCLTH], minrotordesc[MAXROTORDESCLTH];
+  unsigned char **cell = S->cell;
+  boolean known;
 
   if (prefix == 'p')		/* Describe rotor of oscillator */
-    { fillcell(cell, gen-p, gen-1, &minr,&maxr,&minc,&maxc);
+    { fillcell(cell, S->gen-p, S->gen-1, &minr,&maxr,&minc,&maxc);
       if (maxc-minc > maxr-minr)		{ minorient = NWR; maxorient = SER; }
       else if (maxc-minc < maxr-minr)	{ minorient = NWC; maxorient = SEC; }
       else								{ minorient = NWR; maxorient = SEC; }
 
 	  strcpy(minrotordesc, "z");  /* Lexicographically larger than any
                                	     rotor descriptor */
-	  for (g=gen; g > gen-p; g--)
+	  for (g=S->gen; g > S->gen-p; g--)
         { for (orientation = minorient; orientation <= maxorient; orientation++)
             { getrotordesc(cell, p, minr, maxr, minc, maxc, orientation,
 																  rotordesc);
@@ -1305,11 +2698,7 @@ void printoscinfo(int p, char prefix)  /* fcn */
 		}
 
       /* Check to see if minrotordesc is in list of known rotors */
-      for (i=0, known=FALSE; knownrotor[i]; i++)
-        if (strcmp(knownrotor[i], minrotordesc) == 0)
-		  { known = TRUE;
-			break;
-		  }
+      known = (i = findknown(S->known, minrotordesc)) >= 0;
       }
   else		/* Describe 'rotor' of fizzler */
 	/* If, at some generation between 0 and gen-1, the fizzler becomes the
@@ -1318,15 +2707,15 @@ void printoscinfo(int p, char prefix)  /* fcn */
 	   gen 0.  (The loop runs to g==gen, but the last time through we
 	   really do g==0 again.)
 	*/
-	for (g=0; g <= (var[119] ? 0 : gen); g++)
-	  { fillcell(cell, (g==gen ? 0 : g), gen, &minr,&maxr,&minc,&maxc);
+	for (g=0; g <= (S->var[119] ? 0 : S->gen); g++)
+	  { fillcell(cell, (g==S->gen ? 0 : g), S->gen, &minr,&maxr,&minc,&maxc);
         if (maxc-minc > maxr-minr)		{ minorient = NWR; maxorient = SER; }
         else if (maxc-minc < maxr-minr)	{ minorient = NWC; maxorient = SEC; }
         else							{ minorient = NWR; maxorient = SEC; }
 
 	    strcpy(minrotordesc, "z");
 	    for (orientation = minorient; orientation <= maxorient; orientation++)
-          { getrotordesc(cell, gen-(g==gen ? 0 : g), minr, maxr, minc, maxc,
+          { getrotordesc(cell, S->gen-(g==S->gen ? 0 : g), minr,maxr,minc,maxc,
 						                              orientation, rotordesc);
 		    *rotordesc = prefix;  /* Fizzle or eventually periodic */
             if (strcmp(rotordesc, minrotordesc) < 0)
@@ -1334,12 +2723,8 @@ void printoscinfo(int p, char prefix)  /* fcn */
           }
 
         /* Check to see if minrotordesc is in list of known rotors */
-        for (i=0, known=FALSE; knownrotor[i]; i++)
-          if (strcmp(knownrotor[i], minrotordesc) == 0)
-			{ known = TRUE;
-			  break;
-		    }
-		   
+        known = (i = findknown(S->known, minrotordesc)) >= 0;
+
 		if (known)  break;	/* Becomes known fizzler in gen g */
       }
 
@@ -1375,16 +2760,21 @@ void printoscinfo(int p, char prefix)  /* fcn */
   dist--;
 
   /* Print rotor descriptor and name, if known */
-  printf("%s\t", minrotordesc);
+  fprintf(S->out, "%s\t", minrotordesc);
   if (known)
-    if (dist>1)         printf("   %s (gap = %d)\n", name[i],dist-1);
-    else                printf("   %s\n", name[i]);
+    if (dist>1)         fprintf(S->out, "   %s (gap = %d)\n",
+                          S->known->name[i], dist-1);
+    else                fprintf(S->out, "   %s\n", S->known->name[i]);
   else
-    if (dist>1)         printf("<- unknown: split rotor (gap = %d)\n",dist-1);
+    if (dist>1)         fprintf(S->out,
+                          "<- unknown: split rotor (gap = %d)\n",dist-1);
     else
-	  if (prefix == 'u')    printf("<- unknown\n");
-	  else                  printf("<- UNKNOWN\n");
-  fflush(stdout);
+	  if (prefix == 'u')    fprintf(S->out, "<- unknown\n");
+	  else                  fprintf(S->out, "<- UNKNOWN\n");
+  fflush(S->out);
+
+  strcpy(S->rotordesc, minrotordesc);   /* For addresult */
+  S->rotorname = known ? S->known->name[i] : NULL;
 }
 
 /* -------------------------------------------------------------------- */
@@ -1392,7 +2782,7 @@ void printoscinfo(int p, char prefix)  /* fcn */
 #if COUNT
 void printcounts(void)  /* fcn */
 /* Print how many times various functions have been called. */
-{ printf(
+{ fprintf(S->out,
     "setbkgd        %d\n"
     "consistify     %d\n"
     "consis9        %d\n"
@@ -1404,9 +2794,9 @@ void printcounts(void)  /* fcn */
     "nxgen          %d\n"
     "trycell        %d\n"
     "comporbackup   %d 000000\n",
-    countsetbkgd, countconsistify, countconsis9, countproceed,
-    countbackup, countgo, countlistneighbors, countchangecurr, countnxgen,
-    counttrycell, countcomporbackuphi);
+    S->countsetbkgd, S->countconsistify, S->countconsis9, S->countproceed,
+    S->countbackup, S->countgo, S->countlistneighbors, S->countchangecurr,
+    S->countnxgen, S->counttrycell, S->countcomporbackuphi);
 }
 #endif
 
@@ -1416,15 +2806,16 @@ boolean semifizzle(void)    /* fcn */
 /* Checks to see if all changed cells in the current generation are
    within the DONTCOUNT region.
 */
-{  static point *p;
+{  point *p;
 
 #if COUNT
-  if (TRACE) {printf("semifizzle(). chgd[%d]=%d. nays[%d]=%d.\n",
-  gen,(int)(chgd[gen]-chglist),gen,(int)(nays[gen]-chglist));fflush(stdout);}
+  if (TRACE) {fprintf(S->out, "semifizzle(). chgd[%d]=%d. nays[%d]=%d.\n",
+  S->gen,(int)(S->chgd[S->gen]-S->chglist),
+  S->gen,(int)(S->nays[S->gen]-S->chglist));fflush(S->out);}
 #endif
 
-  for (p=chgd[gen]; p<nays[gen]; p++)
-    if (!(flag[p->row][p->col] & DONTCOUNT))  return FALSE;
+  for (p=S->chgd[S->gen]; p<S->nays[S->gen]; p++)
+    if (!(S->flag[p->row][p->col] & DONTCOUNT))  return FALSE;
   return TRUE;
 }
 
@@ -1509,10 +2900,10 @@ void readregion(char *p, region *reg, char def)    /* fcn */
       }
 
     if (reg->minrow < 0)  reg->minrow = 0;
-    if (reg->maxrow > HT-1)  reg->maxrow = HT-1;
+    if (reg->maxrow > S->HT-1)  reg->maxrow = S->HT-1;
     if (reg->mincol < 0)  reg->mincol = 0;
-    if (reg->maxcol > WD-1)  reg->maxcol = WD-1;
-    printf("Region type %c.  Rows %d to %d.  Cols %d to %d.\n",
+    if (reg->maxcol > S->WD-1)  reg->maxcol = S->WD-1;
+    fprintf(S->out, "Region type %c.  Rows %d to %d.  Cols %d to %d.\n",
       reg->regiontype, reg->minrow, reg->maxrow, reg->mincol, reg->maxcol);
 }
 
@@ -1550,33 +2941,41 @@ boolean pointinregion(int row, int col, region *reg)    /* fcn */
 /************************************************************************/
 
 void initarrays(void)   /* fcn */
-/* Initialize bkgd and curr to UNK with OFF boundaries, and flag
-   to FALSE with TRUE boundaries.
+/* Allocate the grids for the current HT and WD.  Initialize bkgd and
+   curr to UNK with OFF boundaries, and flag to FALSE with TRUE
+   boundaries, and empty the lists of settings and changes.
 */
-{ static int r,c;
-
-  for (r=0; r<HT; r++)
-    for (c=0; c<WD; c++)
-       if (r <= 1 || r >= HT-2 || c <= 1 || c >= WD-2)
-        { bkgd[r][c] = curr[r][c] = OFF;
-          flag[r][c] = 0xFF;
+{ int r,c;
+
+  freegrids(S, TRUE);
+  newgrids(S, TRUE);
+  S->nwstng = S->settinglist;
+  S->depth = 0;
+  S->chgd[0] = S->nays[0] = S->chglist;
+
+  for (r=0; r<S->HT; r++)
+    for (c=0; c<S->WD; c++)
+       if (r <= 1 || r >= S->HT-2 || c <= 1 || c >= S->WD-2)
+        { S->bkgd[r][c] = S->curr[r][c] = OFF;
+          S->flag[r][c] = 0xFF;
         }
       else
-        { bkgd[r][c] = curr[r][c] = UNK;
-          flag[r][c] = 0;
+        { S->bkgd[r][c] = S->curr[r][c] = UNK;
+          S->flag[r][c] = 0;
         }
 
-  for (r=1; r<HT-1; r++)
-	for (c=1; c<WD-1; c++)
-	  naysum[r][c] = bkgd[r-1][c-1] + bkgd[r-1][c] + bkgd[r-1][c+1] +
-                     bkgd[r  ][c-1] +                bkgd[r  ][c+1] +
-                     bkgd[r+1][c-1] + bkgd[r+1][c] + bkgd[r+1][c+1];
+  for (r=1; r<S->HT-1; r++)
+	for (c=1; c<S->WD-1; c++)
+	  S->naysum[r][c] =
+        S->bkgd[r-1][c-1] + S->bkgd[r-1][c] + S->bkgd[r-1][c+1] +
+        S->bkgd[r  ][c-1] +                   S->bkgd[r  ][c+1] +
+        S->bkgd[r+1][c-1] + S->bkgd[r+1][c] + S->bkgd[r+1][c+1];
 }
 
 /* -------------------------------------------------------------------- */
 
-void initconsistable(void)  /* fcn */
-/* Initialize consistable. */
+void initconsistable(ruletable *t)  /* fcn */
+/* Initialize t->consistable. */
 { int val, oncount, offcount, unkcount, nbhd, i,
       survct, deathct, birthct, sterilect;
 
@@ -1590,47 +2989,47 @@ void initconsistable(void)  /* fcn */
 
       if (val==ON || val==UNK)
         for (i=oncount; i<=oncount+unkcount; i++)
-          if (rule[ON][i])  survct++;
+          if (t->rule[ON][i])  survct++;
           else              deathct++;
 
       if (val==OFF || val==UNK)
         for (i=oncount; i<=oncount+unkcount; i++)
-          if (rule[OFF][i]) birthct++;
+          if (t->rule[OFF][i]) birthct++;
           else              sterilect++;
 
-      if (sterilect==0 && survct==0)        consistable[val][nbhd] = INCONSIS;
-      else if (val==UNK && sterilect==0)    consistable[val][nbhd] = CELLON;
-      else if (val==UNK && survct==0)       consistable[val][nbhd] = CELLOFF;
-      else if (unkcount==0)                 consistable[val][nbhd] = NOINFO;
+      if (sterilect==0 && survct==0)        t->consistable[val][nbhd] = INCONSIS;
+      else if (val==UNK && sterilect==0)    t->consistable[val][nbhd] = CELLON;
+      else if (val==UNK && survct==0)       t->consistable[val][nbhd] = CELLOFF;
+      else if (unkcount==0)                 t->consistable[val][nbhd] = NOINFO;
       else
         if (val==OFF)
-          if (sterilect==1 && !rule[OFF][oncount])
-                                            consistable[val][nbhd] = NAYSOFF;
-          else if (sterilect==1 && !rule[OFF][oncount+unkcount])
-                                            consistable[val][nbhd] = NAYSON;
-          else                              consistable[val][nbhd] = NOINFO;
+          if (sterilect==1 && !t->rule[OFF][oncount])
+                                            t->consistable[val][nbhd] = NAYSOFF;
+          else if (sterilect==1 && !t->rule[OFF][oncount+unkcount])
+                                            t->consistable[val][nbhd] = NAYSON;
+          else                              t->consistable[val][nbhd] = NOINFO;
         else if (val==ON)
-          if (survct==1 && rule[ON][oncount])
-                                            consistable[val][nbhd] = NAYSOFF;
-          else if (survct==1 && rule[ON][oncount+unkcount])
-                                            consistable[val][nbhd] = NAYSON;
-          else                              consistable[val][nbhd] = NOINFO;
+          if (survct==1 && t->rule[ON][oncount])
+                                            t->consistable[val][nbhd] = NAYSOFF;
+          else if (survct==1 && t->rule[ON][oncount+unkcount])
+                                            t->consistable[val][nbhd] = NAYSON;
+          else                              t->consistable[val][nbhd] = NOINFO;
         else    /* val==UNK */
-          if (sterilect==1 && !rule[OFF][oncount] &&
-              survct==1 && rule[ON][oncount])
-                                            consistable[val][nbhd] = NAYSOFF;
-          else if (sterilect==1 && !rule[OFF][oncount+unkcount] &&
-                    survct==1 && rule[ON][oncount+unkcount])
-                                            consistable[val][nbhd] = NAYSON;
-          else                              consistable[val][nbhd] = NOINFO;
+          if (sterilect==1 && !t->rule[OFF][oncount] &&
+              survct==1 && t->rule[ON][oncount])
+                                            t->consistable[val][nbhd] = NAYSOFF;
+          else if (sterilect==1 && !t->rule[OFF][oncount+unkcount] &&
+                    survct==1 && t->rule[ON][oncount+unkcount])
+                                            t->consistable[val][nbhd] = NAYSON;
+          else                              t->consistable[val][nbhd] = NOINFO;
           
     }
 }
 
 /* -------------------------------------------------------------------- */
 
-void inittranstable(void)   /* fcn */
-/* Initialize transtable. */
+void inittranstable(ruletable *t)   /* fcn */
+/* Initialize t->transtable. */
 { int val, oncount, offcount, unkcount, nbhd, i;
   boolean maybeon, maybeoff;
 
@@ -1641,13 +3040,13 @@ void inittranstable(void)   /* fcn */
       nbhd = oncount + unkcount*UNK;
 
       for (i=oncount, maybeon=maybeoff=FALSE; i<=oncount+unkcount; i++)
-        if (rule[val][i])   maybeon = TRUE;
+        if (t->rule[val][i])   maybeon = TRUE;
         else                maybeoff = TRUE;
 
       if (maybeon)
-        if (maybeoff)   transtable[val][nbhd] = UNK;
-        else            transtable[val][nbhd] = ON;
-      else              transtable[val][nbhd] = OFF;
+        if (maybeoff)   t->transtable[val][nbhd] = UNK;
+        else            t->transtable[val][nbhd] = ON;
+      else              t->transtable[val][nbhd] = OFF;
     }
 }
 
@@ -1656,8 +3055,11 @@ void inittranstable(void)   /* fcn */
 void setrule(char *p)   /* fcn */
 /* Read rule.  E.g. the rule for Life could be given as "B3/S23" or
    "b3/s23" or "b3s23" or "3s23" or "3/23" or "s2b3S3" or ...
+   If no search has used the rule before, compute its tables.
 */
 { int i,val;
+  boolean rule[2][9];
+  ruletable *t;
 
   for (val=OFF; val<=ON; val++)
     for (i=0; i<=8; i++)  rule[val][i] = 0;
@@ -1671,31 +3073,70 @@ void setrule(char *p)   /* fcn */
       else
         rule[val][*p - '0'] = 1;
     }
-  inittranstable();
-  initconsistable();
-  printf("Rule set to B");
-  for (i=0; i<=8; i++)  if (rule[OFF][i])  printf("%d",i);
-  printf("/S");
-  for (i=0; i<=8; i++)  if (rule[ON][i])  printf("%d",i);
-  printf("\n");
+
+#if THREADS
+  pthread_mutex_lock(&sharedlock);
+#endif
+  for (t=ruletables; t; t=t->link)
+    if (!memcmp(t->rule, rule, sizeof(rule)))  break;
+  if (!t)
+    { if (!(t = malloc(sizeof(ruletable))))
+        {
+#if THREADS
+          pthread_mutex_unlock(&sharedlock);
+#endif
+          err("Out of memory in setrule()");
+        }
+      memcpy(t->rule, rule, sizeof(rule));
+      inittranstable(t);
+      initconsistable(t);
+      t->link = ruletables;
+      ruletables = t;
+    }
+#if THREADS
+  pthread_mutex_unlock(&sharedlock);
+#endif
+  S->rules = t;
+
+  fprintf(S->out, "Rule set to B");
+  for (i=0; i<=8; i++)  if (rule[OFF][i])  fprintf(S->out, "%d",i);
+  fprintf(S->out, "/S");
+  for (i=0; i<=8; i++)  if (rule[ON][i])  fprintf(S->out, "%d",i);
+  fprintf(S->out, "\n");
+}
+
+/* -------------------------------------------------------------------- */
+
+int patternchar(void)   /* fcn */
+/* Return the next character of the pattern being read, taken from the
+   text given with the read command if there is any, otherwise from
+   standard input.
+*/
+{ if (!S->patternsrc)  return getchar();
+  if (!*S->patternsrc)  return EOF;
+  return *S->patternsrc++;
 }
 
 /* -------------------------------------------------------------------- */
 
 void readpattern(int r0, int c0)    /* fcn */
 /* Read initial values of bkgd and curr and bits 0 of flag */
-{ static int r,c,bg,cr;
-  static char ch;
+{ int r,c,bg,cr;
+  char ch;
 
+  initorbits();         /* For the symmetry as it is now */
   r = r0;  c = c0;
 
   while (TRUE)
-    { ch = getchar();
+    { ch = patternchar();
+
+      if (strchr(".:oO01s?", ch) && (r >= S->HT || c >= S->WD))
+        err("Pattern doesn't fit in space");
 
-	  if (ch==':' || ch=='O' || ch=='s')	flag[r][c] |= DONTCHANGE;
+	  if (ch==':' || ch=='O' || ch=='s')	S->flag[r][c] |= DONTCHANGE;
 
-	  if (var[127] && (ch=='.' || ch=='o' || ch=='0' || ch=='1' || ch=='?'))
-		flag[r][c] |= DONTCOUNT;
+	  if (S->var[127] && (ch=='.' || ch=='o' || ch=='0' || ch=='1' || ch=='?'))
+		S->flag[r][c] |= DONTCOUNT;
 
       switch (ch)
         { case '.': case ':':	bg=0;  cr=0;  break;
@@ -1704,19 +3145,22 @@ void readpattern(int r0, int c0)    /* fcn */
           case '1':				bg=0;  cr=1;  break;
           case ',': case '?': case 's':		c++;	continue;
           case '\n':			r++;   c=c0;  continue;
-          case '!':  while (getchar() != '\n');     return;
+          case '!':  while ((ch = patternchar()) != '\n' && ch != EOF)
+                       ;
+                     return;
           default:   err("Bad character or EOF while reading");
         }
 
-      if (bkgd[r][c] == (1^bg) || (bkgd[r][c] == UNK && proceed(r,c,bg,0)==ERR))
-        { printf("readpattern error: bkgd[%d, %d] = %d.  bg = %d\n",
-			r,c,(int)bkgd[r][c], bg);
+      if (S->bkgd[r][c] == (1^bg) ||
+          (S->bkgd[r][c] == UNK && proceed(r,c,bg,0)==ERR))
+        { fprintf(S->out, "readpattern error: bkgd[%d, %d] = %d.  bg = %d\n",
+			r,c,(int)S->bkgd[r][c], bg);
           display(0);
-          exit(1);
+          fail();
         }
 
       if (bg != cr)
-        { nays[0]->row = r;  (nays[0]++)->col = c;
+        { S->nays[0]->row = r;  (S->nays[0]++)->col = c;
         }
 
       c++;
@@ -1725,63 +3169,282 @@ void readpattern(int r0, int c0)    /* fcn */
 
 /* -------------------------------------------------------------------- */
 
-int readknownrotors(void)   /* fcn */
+knownrotors *newknownrotors(char *filename)    /* fcn */
+/* Return a new, empty set of known rotors, to be read from filename. */
+{ knownrotors *k;
+
+  if (!(k = calloc(1, sizeof(knownrotors))) ||
+      !(k->rotor = malloc((MAXKNOWN+1)*sizeof(char *))) ||
+      !(k->name = malloc((MAXKNOWN+1)*sizeof(char *))))
+    err("Out of memory in newknownrotors()");
+  sprintf(k->filename, "%.99s", filename);
+  return k;
+}
+
+/* -------------------------------------------------------------------- */
+
+void freeknownrotors(knownrotors *k)    /* fcn */
+/* Free a set of known rotors, which no search is using. */
+{ if (k->map)  munmap(k->map, k->maplth);
+  free(k->text);
+  free(k->indexbuf);
+  free(k->rotor);
+  free(k->name);
+  free(k);
+}
+
+/* -------------------------------------------------------------------- */
+
+void readknownrotors(knownrotors *k)    /* fcn */
 /* Reads a list of known rotor descriptors and corresponding names from
-   the file "knownrotors".  Each rotor is defined by 1 or more lines of the
+   the file k->filename.  Each rotor is defined by 1 or more lines of the
    file.  The first line begins with the rotor descriptor, which may
    continue on subsequent lines and/or end with a carriage return if it's
    large.  That's followed by 1 or more tabs.  The tabs are followed by the
    name of the oscillator.  The rotor descriptors and names are read into
-   the arrays knownrotor and name.  The number of rotors read is returned.
+   k->text, with pointers to them in k->rotor and k->name.  If the file
+   can't be read, k is freed.
 */
-{ FILE *knownrotorsfile;
-  int i;
+#define readerr(msg)    { if (f)  fclose(f); \
+                          freeknownrotors(k); \
+                          err(msg) }
+{ FILE *f = NULL;
+  int i, n;
+  unsigned int j;
   boolean readingname;
   char ch, *p;
 
-  if ((knownrotorsfile = fopen(knownrotorsfilename, "r")) == NULL)
-    err("Can't open known rotors file.\n");
+  if (!(k->text = malloc(MAXFILESIZE)) ||
+      !(k->indexbuf = calloc(KNOWNHASHSIZE, sizeof(int))))
+    readerr("Out of memory in readknownrotors()")
+  if ((f = fopen(k->filename, "r")) == NULL)
+    readerr("Can't open known rotors file.\n")
 
   i=0;
   readingname = FALSE;
-  p = knownrotor[i] = knownrotorsandnames;
+  p = k->rotor[i] = k->text;
 
-  while (ch=fgetc(knownrotorsfile), !feof(knownrotorsfile))
+  while (ch=fgetc(f), !feof(f))
     if (ch == '\t')
       { *p++ = 0;                   /* Mark end of rotor */
         readingname = TRUE;         /* Switch to reading name */
-        name[i] = p;
+        k->name[i] = p;
       }
     else if (ch == '\n')
       { if (readingname)
           { *p++ = 0;               /* Mark end of name */
             readingname = FALSE;    /* Switch to reading rotor */
             if (++i >= MAXKNOWN)
-              err("Too many known rotors; increase MAXKNOWN.");
-            knownrotor[i] = p;
+              readerr("Too many known rotors; increase MAXKNOWN.")
+            k->rotor[i] = p;
           }
       }
-    else    *p++ = ch;
+    else if (p < k->text + MAXFILESIZE - 5)  *p++ = ch;
+    else  readerr("Known rotors file is too big.  Increase MAXFILESIZE.\n")
+  fclose(f);
 
   *p = 0;                           /* Mark end of last name */
-  knownrotor[i] = NULL;             /* Mark end of list */
-  if (p > knownrotorsandnames + MAXFILESIZE - 5)
-    err("Known rotors file is too big.  Increase MAXFILESIZE.\n");
-  return i;
+  k->rotor[i] = NULL;               /* Mark end of list */
+  k->numknown = i;
+
+  /* Index them by descriptor.  If a descriptor occurs more than once, */
+  /* only the first one is indexed, so that its name is the one used.  */
+  k->index = k->indexbuf;
+  for (n=0; n<i; n++)
+    if (findknown(k, k->rotor[n]) < 0)
+      { j = knownhash(k->rotor[n]);
+        while (k->index[j & (KNOWNHASHSIZE-1)])  j++;
+        k->index[j & (KNOWNHASHSIZE-1)] = n+1;
+      }
+}
+#undef readerr
+
+/* -------------------------------------------------------------------- */
+
+boolean rotordbok(char *base, long int size)    /* fcn */
+/* Return TRUE if the size bytes at base are a known rotor database that
+   can be used here.  Every count and offset in it is checked against
+   size, so a truncated one, or one written on a machine with another
+   byte order or word size, is passed over instead of being read out of
+   bounds.
+*/
+{ rotordbheader *h = (rotordbheader *) base;
+  int i, *index = (int *) (h+1), *offset = index + KNOWNHASHSIZE;
+  long int start;
+
+  if (strncmp(h->magic, ROTORDBMAGIC, sizeof(h->magic)) ||
+      h->byteorder != ROTORDBORDER || h->lth != size ||
+      h->hashsize != KNOWNHASHSIZE || h->numknown < 0 ||
+      h->numknown >= MAXKNOWN)
+    return FALSE;
+  start = sizeof(*h) + (KNOWNHASHSIZE + 2L*h->numknown)*sizeof(int);
+  if (start > size || (h->numknown && base[size-1]))  /* Last name must */
+    return FALSE;                                     /* be ended       */
+  for (i=0; i<KNOWNHASHSIZE; i++)
+    if (index[i] < 0 || index[i] > h->numknown)  return FALSE;
+  for (i=0; i<2*h->numknown; i++)
+    if (offset[i] < start || offset[i] >= size)  return FALSE;
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean maprotordb(knownrotors *k, char *filename)  /* fcn */
+/* If filename is a known rotor database that's at least as new as the
+   text file k->filename, map it into memory as k and return TRUE;
+   otherwise return FALSE.  The file is mapped read-only, so all
+   processes using it share one copy.
+*/
+{ int fd, i, *offset;
+  struct stat st, textst;
+  rotordbheader *h;
+  char *base;
+
+  if ((fd = open(filename, O_RDONLY)) < 0)  return FALSE;
+  if (fstat(fd, &st) || st.st_size < (off_t) sizeof(rotordbheader) ||
+      (!stat(k->filename, &textst) &&
+       strcmp(filename, k->filename) &&
+       textst.st_mtime > st.st_mtime))
+    { close(fd);
+      return FALSE;
+    }
+  base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED)  return FALSE;
+
+  if (!rotordbok(base, st.st_size))
+    { munmap(base, st.st_size);
+      return FALSE;
+    }
+  h = (rotordbheader *) base;
+  k->map = base;
+  k->maplth = st.st_size;
+  k->numknown = h->numknown;
+  k->index = (int *) (h+1);
+  offset = k->index + KNOWNHASHSIZE;
+  for (i=0; i<h->numknown; i++)
+    { k->rotor[i] = base + offset[i];
+      k->name[i] = base + offset[h->numknown+i];
+    }
+  k->rotor[i] = NULL;
+  return TRUE;
+}
+
+/* -------------------------------------------------------------------- */
+
+void writerotordb(char *filename)   /* fcn */
+/* Read the known rotors from the text file S->knownrotorsfilename and
+   write them to filename as a database for maprotordb().
+*/
+{ FILE *f;
+  knownrotors *k;
+  rotordbheader h;
+  int i, offset[2*MAXKNOWN];
+  long int lth;
+
+  k = newknownrotors(S->knownrotorsfilename);
+  readknownrotors(k);
+  memset(&h, 0, sizeof(h));
+  strcpy(h.magic, ROTORDBMAGIC);
+  h.byteorder = ROTORDBORDER;
+  h.numknown = k->numknown;
+  h.hashsize = KNOWNHASHSIZE;
+  lth = h.numknown ? k->name[h.numknown-1] + strlen(k->name[h.numknown-1])
+                       + 1 - k->text
+                   : 0;
+  for (i=0; i<h.numknown; i++)
+    { offset[i] = k->rotor[i] - k->text;
+      offset[h.numknown+i] = k->name[i] - k->text;
+    }
+  for (i=0; i<2*h.numknown; i++)
+    offset[i] += sizeof(h) + (KNOWNHASHSIZE + 2*h.numknown)*sizeof(int);
+  h.lth = sizeof(h) + (KNOWNHASHSIZE + 2*h.numknown)*sizeof(int) + lth;
+
+  f = fopen(filename, "wb");
+  i = !f ||
+      fwrite(&h, sizeof(h), 1, f) != 1 ||
+      fwrite(k->index, sizeof(int), KNOWNHASHSIZE, f) != KNOWNHASHSIZE ||
+      fwrite(offset, sizeof(int), 2*h.numknown, f) != (size_t) 2*h.numknown ||
+      fwrite(k->text, 1, lth, f) != (size_t) lth;
+  if ((f && fclose(f)) || i)
+    { freeknownrotors(k);
+      err1("Can't write known rotor database %s", filename)
+    }
+  fprintf(S->out, "%d known rotors from '%s' written to '%s'\n",
+    h.numknown, k->filename, filename);
+  freeknownrotors(k);
+}
+
+/* -------------------------------------------------------------------- */
+
+knownrotors *getknownrotors(void)   /* fcn */
+/* Return the known rotors from the file S->knownrotorsfilename, reading
+   it (or mapping its database) unless some search has already done so.
+   The file is read without holding sharedlock, so that an error can't
+   leave it locked; if two searches read it at once, the second copy is
+   thrown away.
+*/
+{ knownrotors *k, *nk;
+  char dbname[100];
+
+#if THREADS
+  pthread_mutex_lock(&sharedlock);
+#endif
+  for (k=knownrotorlist; k; k=k->link)
+    if (!strcmp(k->filename, S->knownrotorsfilename))  break;
+#if THREADS
+  pthread_mutex_unlock(&sharedlock);
+#endif
+  if (k)
+    { fprintf(S->out, "Using %d known rotors from '%s'\n\n",
+        k->numknown, k->filename);
+      return k;
+    }
+
+  nk = newknownrotors(S->knownrotorsfilename);
+  sprintf(dbname, "%.95s.db", nk->filename);
+  if (maprotordb(nk, dbname) ||
+      maprotordb(nk, strcpy(dbname, nk->filename)))
+    fprintf(S->out, "Mapped file '%s'\n", dbname);
+  else
+    { fprintf(S->out, "Reading file '%s'\n", nk->filename);
+      fflush(S->out);
+      readknownrotors(nk);
+    }
+  fprintf(S->out, "%d known rotors read\n\n", nk->numknown);
+
+#if THREADS
+  pthread_mutex_lock(&sharedlock);
+#endif
+  for (k=knownrotorlist; k; k=k->link)
+    if (!strcmp(k->filename, nk->filename))  break;
+  if (!k)
+    { nk->link = knownrotorlist;
+      knownrotorlist = k = nk;
+    }
+#if THREADS
+  pthread_mutex_unlock(&sharedlock);
+#endif
+  if (k != nk)  freeknownrotors(nk);
+  return k;
 }
 
 /* -------------------------------------------------------------------- */
 
 void listcommands(void) /* fcn */
 /* Print list of commands */
-{ printf(   "Commands are:\n\n"
+{ constraint *con;
+  char buf[30];
+
+  fprintf(S->out,    "Commands are:\n\n"
             "h#          Set max height of changed region\n"
             "w#          Set max width of changed region\n"
             "c#          Set max number of changed cells\n"
             "s#          Set random number seed\n"
             "P#          Set probability for free choices\n"
-            "H#          Set height of space (<=81, usually 80 or 81)\n"
-            "W#          Set width of space (<=81, usually 80 or 81)\n"
+            "H#          Set height of space (5 to 1024, default 81)\n"
+            "W#          Set width of space (5 to 1024, default 81)\n"
+            "T#          Set number of search threads\n"
             "Rb###/s###  Set rule\n\n"
 
             "r# #        Read bkgd and curr\n"
@@ -1795,7 +3458,10 @@ void listcommands(void) /* fcn */
             "skipstable  Don't print stable outcomes (except fizzles)\n"
 			"nopics      Don't show patterns, just rotor descriptors\n"
             "skipfizzle  Don't print fizzle outcomes\n"
-            "showfin     Show finished patterns\n\n"
+            "showfin     Show finished patterns\n"
+            "canonhash   Treat shifted or reflected histories as duplicates\n"
+            "lookahead   Cut branches whose known changes are already too big\n"
+            "nogoods #   Remember up to # local contradictions (default 65536)\n\n"
 
             "nosymm      No symmetry\n"
             "horsymm     Symmetry across horizontal line\n"
@@ -1807,96 +3473,227 @@ void listcommands(void) /* fcn */
             "xsymm       Symmetry across both diagonal lines\n"
             "fullsymm    Full symmetry\n\n"
 
+            "checkpoint <file> # #\n"
+            "            Write checkpoint every # million calls, # seconds\n"
+            "resume <file>\n"
+            "            Resume search from checkpoint\n"
+            "split K/N # #\n"
+            "            Search part K (0 to N-1) of N, shared pieces cut\n"
+            "            at depth #, # calls per sample\n"
+            "frontier #  List paths of subtrees at depth #\n"
+            "path 0101.. Search only the subtree below path\n"
+            "branch <cell> <value>\n"
+            "            Branching heuristic: first, constrained, or probe\n"
+            "            cell; random or least constraining value\n\n"
+
+            "K<file>     Read known rotors from file\n"
+            "rotordb <file>\n"
+            "            Compile known rotors into database file and exit\n\n"
+
             "v# #        Set variable (for program modifications)\n"
             "?           Print this list\n"
             ";<text>     Comment\n"
             "\n"
+            "Constraints (each is the same as v# # for the variables shown):\n\n"
         );
+
+  for (con=constraints; con->cellcheck || con->gencheck; con++)
+    if (con->name)
+      { sprintf(buf, "%s #%s", con->name, con->var2 ? " #" : "");
+        fprintf(S->out, "%-18s%-40s v%d", buf, con->help, con->var);
+        if (con->var2)  fprintf(S->out, " v%d", con->var2);
+        fprintf(S->out, "\n");
+      }
+  fprintf(S->out, "\n");
 }
 
 /* -------------------------------------------------------------------- */
 
-void docommand(char *p, boolean cmdline)    /* fcn */
+boolean docommand(char *p, boolean cmdline) /* fcn */
 /* Do the command pointed to by p.  The command may have been given as
    a command line argument (if cmdline is TRUE) or read from standard
    input.  In the case of a read command, additional lines will be
    read to complete the command, so this can't be done from the
-   command line.
+   command line.  Return FALSE if the program has nothing more to do
+   (after rotordb).
 */
 { int i,r,c,bitposition,varnum;
   long int varval;
   region reg;
   char cmd;
+  constraint *con;
 
   cmd = *p;
   if (cmd == ';')
-	printf("%s\n",p);   /* Comment */
+	fprintf(S->out, "%s\n",p);   /* Comment */
 
   else if (!strcmp(p, "?"))    listcommands();
 
-  else if (!strcmp(p, "nosymm"))        SYMM = NOSYMM;
-  else if (!strcmp(p, "horsymm"))       SYMM = HORSYMM;
-  else if (!strcmp(p, "vertsymm"))      SYMM = VERTSYMM;
-  else if (!strcmp(p, "diagsymm"))      SYMM = DIAGSYMM;
-  else if (!strcmp(p, "rot90symm"))     SYMM = ROT90SYMM;
-  else if (!strcmp(p, "rot180symm"))    SYMM = ROT180SYMM;
-  else if (!strcmp(p, "plussymm"))      SYMM = PLUSSYMM;
-  else if (!strcmp(p, "xsymm"))         SYMM = XSYMM;
-  else if (!strcmp(p, "fullsymm"))      SYMM = FULLSYMM;
-
-  else if (!strcmp(p, "skipstable"))    SKIPSTABLE = TRUE;
-  else if (!strcmp(p, "nopics"))        NOPICS = TRUE;
-  else if (!strcmp(p, "skipfizzle"))    SKIPFIZZLE = TRUE;
-  else if (!strcmp(p, "showfin"))       SHOWFIN = TRUE;
-  else if (!strcmp(p, "showall"))       SHOWALL = TRUE;
+  else if (!strcmp(p, "nosymm"))        S->SYMM = NOSYMM;
+  else if (!strcmp(p, "horsymm"))       S->SYMM = HORSYMM;
+  else if (!strcmp(p, "vertsymm"))      S->SYMM = VERTSYMM;
+  else if (!strcmp(p, "diagsymm"))      S->SYMM = DIAGSYMM;
+  else if (!strcmp(p, "rot90symm"))     S->SYMM = ROT90SYMM;
+  else if (!strcmp(p, "rot180symm"))    S->SYMM = ROT180SYMM;
+  else if (!strcmp(p, "plussymm"))      S->SYMM = PLUSSYMM;
+  else if (!strcmp(p, "xsymm"))         S->SYMM = XSYMM;
+  else if (!strcmp(p, "fullsymm"))      S->SYMM = FULLSYMM;
+
+  else if (!strcmp(p, "skipstable"))    S->SKIPSTABLE = TRUE;
+  else if (!strcmp(p, "nopics"))        S->NOPICS = TRUE;
+  else if (!strcmp(p, "skipfizzle"))    S->SKIPFIZZLE = TRUE;
+  else if (!strcmp(p, "showfin"))       S->SHOWFIN = TRUE;
+  else if (!strcmp(p, "showall"))       S->SHOWALL = TRUE;
+  else if (!strcmp(p, "canonhash"))     S->CANONHASH = TRUE;
+  else if (!strcmp(p, "lookahead"))     S->LOOKAHEAD = TRUE;
+  else if (!strncmp(p, "nogoods", 7))
+    { S->nogoodsize = 65536;
+      sscanf(p+7, "%ld", &S->nogoodsize);
+      fprintf(S->out, "Nogood store: %ld entries\n", S->nogoodsize);
+    }
+
+  else if ((con = findconstraint(p)))     /* Same as v# # for its var(s) */
+    { sscanf(p+strlen(con->name), "%ld %ld", &S->var[con->var],
+             con->var2 ? &S->var[con->var2] : &varval);
+      fprintf(S->out, "%s = %ld", con->name, S->var[con->var]);
+      if (con->var2)  fprintf(S->out, " %ld", S->var[con->var2]);
+      fprintf(S->out, "\n");
+    }
+
+  else if (!strncmp(p, "branch", 6))
+    { char cellname[20], valuename[20];
+
+      if (sscanf(p+6, "%19s %19s", cellname, valuename) < 2)
+        err("Usage: branch <cell> <value>");
+      for (i=0; branchcellname[i] && strcmp(cellname, branchcellname[i]); i++)
+        ;
+      if (!branchcellname[i])  err1("Unknown branching cell choice: %s", cellname)
+      S->branchcell = i;
+      for (i=0; branchvaluename[i] && strcmp(valuename, branchvaluename[i]);
+           i++)
+        ;
+      if (!branchvaluename[i])
+        err1("Unknown branching value choice: %s", valuename)
+      S->branchvalue = i;
+      fprintf(S->out, "Branching: %s cell, %s value\n",
+              branchcellname[S->branchcell], branchvaluename[S->branchvalue]);
+    }
+
+  else if (!strncmp(p, "checkpoint", 10))
+    { S->checkpointcalls = S->checkpointsecs = 0;
+      if (sscanf(p+10, "%99s %ld %ld", S->checkpointfile,
+                 &S->checkpointcalls, &S->checkpointsecs) < 1)
+        err("Checkpoint file name missing");
+      fprintf(S->out, "Checkpointing to %s", S->checkpointfile);
+      if (S->checkpointcalls)
+        fprintf(S->out, " every %ld million calls", S->checkpointcalls);
+      if (S->checkpointsecs)
+        fprintf(S->out, " every %ld seconds", S->checkpointsecs);
+      fprintf(S->out, "\n");
+    }
+
+  else if (!strncmp(p, "split", 5))
+    { c = 30;
+      varval = 1000;
+      if (sscanf(p+5, "%d/%d %d %ld", &i, &r, &c, &varval) < 2 ||
+          r < 1 || i < 0 || i >= r || c < 1 || varval < 1)
+        err("Bad split command");
+      S->splitindex = i;
+      S->splitcount = r;
+      S->splitdepth = c;
+      S->samplecalls = varval;
+      fprintf(S->out, "Searching part %d of %d, sampling %ld calls per piece,"
+        " shared pieces split at depth %d\n", S->splitindex, S->splitcount,
+        S->samplecalls, S->splitdepth);
+    }
+
+  else if (!strncmp(p, "frontier", 8))
+    { S->splitcount = 0;
+      if ((S->splitdepth = atoi(p+8)) < 1)  err("Bad frontier depth");
+    }
+
+  else if (!strncmp(p, "path", 4))
+    { p += 4;
+      while (*p == ' ')  p++;
+      if (!(S->forcedpath = malloc(strlen(p)+1)))
+        err("Out of memory in docommand()");
+      for (S->forcedlth=0; *p == '0' || *p == '1'; p++)
+        S->forcedpath[S->forcedlth++] = *p - '0';
+      if (*p)  err("Bad path");
+      S->forcedpos = 0;
+      fprintf(S->out, "Searching below path of length %d\n", S->forcedlth);
+    }
+
+  else if (!strncmp(p, "resume", 6))
+    { if (sscanf(p+6, "%99s", S->resumefile) != 1)
+        err("Checkpoint file name missing");
+    }
 
   else if (*p == 'c' && *(p+1) == 'c')					/* "cc" command */
 	{ p+=2;
 	  while (*p == ' ')  p++;
-	  for (numcc=0; *p; numcc++)
-		{ reqchgcount[numcc] = atoi(p);
+	  for (S->numcc=0; *p; S->numcc++)
+		{ S->reqchgcount[S->numcc] = atoi(p);
 		  while (*p != ' ' && *p)  p++;
 		  while (*p == ' ')  p++;
 		}
-	  printf("Initial change counts must be:");
-	  for (i=0; i<numcc; i++)  printf(" %d", reqchgcount[i]);
-	  printf("\n");
+	  fprintf(S->out, "Initial change counts must be:");
+	  for (i=0; i<S->numcc; i++)  fprintf(S->out, " %d", S->reqchgcount[i]);
+	  fprintf(S->out, "\n");
 	}
 
   else if (cmd == 's')
     { KRsrand(atoi(p+1));
-      printf("Random seed = %ld\n", atoi(p+1));
+      fprintf(S->out, "Random seed = %d\n", atoi(p+1));
     }
 
-  else if (cmd == 'P')  prob = atoi(p+1);
-  else if (cmd == 'h')  maxheight = atoi(p+1);
-  else if (cmd == 'w')  maxwidth = atoi(p+1);
-  else if (cmd == 'c')  maxchng = atoi(p+1);
+  else if (cmd == 'P')  S->prob = atoi(p+1);
+  else if (cmd == 'h')  S->maxheight = atoi(p+1);
+  else if (cmd == 'w')  S->maxwidth = atoi(p+1);
+  else if (cmd == 'c')  S->maxchng = atoi(p+1);
   else if (cmd == 'R')  setrule(p+1);
 
   else if (cmd == 'H')
-    { HT = atoi(p+1);
-      if (HT < 0 || HT > MAXHT)  err("Bad height");
+    { if ((r = atoi(p+1)) < MINHT || r > MAXHT)  err("Bad height");
+      S->HT = r;
       initarrays();
-      printf("Height changed, so universe cleared.\n");
+      fprintf(S->out, "Height changed, so universe cleared.\n");
     }
 
   else if (cmd == 'W')
-    { WD = atoi(p+1);
-      if (WD < 0 || WD > MAXWD)  err("Bad width");
+    { if ((c = atoi(p+1)) < MINWD || c > MAXWD)  err("Bad width");
+      S->WD = c;
       initarrays();
-      printf("Width changed, so universe cleared.\n");
+      fprintf(S->out, "Width changed, so universe cleared.\n");
     }
 
   else if (cmd == 'K')
-    { strcpy(knownrotorsfilename, p+1);
+    { strcpy(S->knownrotorsfilename, p+1);
+    }
+
+  else if (!strncmp(p, "rotordb", 7))
+    { p += 7;
+      while (*p == ' ')  p++;
+      if (!*p)  err("Database file name missing");
+      writerotordb(p);
+      return FALSE;
     }
 
+  else if (cmd == 'T')
+#if THREADS
+    { S->numthreads = atoi(p+1);
+      if (S->numthreads < 1)  err("Bad number of threads");
+      fprintf(S->out, "Using %d threads\n", S->numthreads);
+    }
+#else
+    err("Compiled without THREADS; can't use T command")
+#endif
+
   else if (cmd == 'v')
-    { sscanf(p+1, "%d %d", &varnum, &varval);
+    { sscanf(p+1, "%d %ld", &varnum, &varval);
       if (varnum<0 || varnum>=NUMVARS)  err("Bad variable number");
-      var[varnum] = varval;
-	  printf("var[%d] = %ld\n",varnum,varval);
+      S->var[varnum] = varval;
+	  fprintf(S->out, "var[%d] = %ld\n",varnum,varval);
     }
 
   else if (cmd == 'r' && !cmdline)
@@ -1909,308 +3706,1087 @@ void docommand(char *p, boolean cmdline)    /* fcn */
         { bitposition = *(p+1) - '0';
           if (bitposition<0 || bitposition>7)
             err("Bad bit in 'd' or 'D' command.");
-          if (cmd == 'd')  printf("Setting flag %d in region\n",bitposition);
-          else  printf("Clearing flag %d in region\n",bitposition);
+          if (cmd == 'd')
+            fprintf(S->out, "Setting flag %d in region\n",bitposition);
+          else
+            fprintf(S->out, "Clearing flag %d in region\n",bitposition);
           p++;
         }
       readregion(p+1, &reg, 'r');
-      for (r=reg.minrow; r<=reg.maxrow; r++)
-      for (c=reg.mincol; c<=reg.maxcol; c++)
+      if (cmd == 'C')  initorbits();    /* For the symmetry as it is now */
+      for (r=max(reg.minrow,0); r<=reg.maxrow && r<S->HT; r++)
+      for (c=max(reg.mincol,0); c<=reg.maxcol && c<S->WD; c++)
       if (pointinregion(r,c,&reg))
         switch(cmd)
           { case 'C':
-              if (bkgd[r][c] == UNK && proceed(r,c,0,0)==ERR)
-                { printf("Error in Clear command: r=%d c=%d\n",r,c);
+              if (S->bkgd[r][c] == UNK && proceed(r,c,0,0)==ERR)
+                { fprintf(S->out, "Error in Clear command: r=%d c=%d\n",r,c);
                   display(0);
-                  exit(1);
+                  fail();
                 }
               break;
             case 'd':
-              flag[r][c] |= 1<<bitposition;
+              S->flag[r][c] |= 1<<bitposition;
               break;
             case 'D':
-              flag[r][c] &= ~(1<<bitposition);
+              S->flag[r][c] &= ~(1<<bitposition);
               break;
           }
     }
 
   else  err1("Unknown command: %s", p);
+  return TRUE;
 }
 
 /************************************************************************/
-/* The main program.  It first reads the file "knownrotors" and         */
-/* initializes things based on commands in the command line and         */
-/* standard input.  Then it calls computecellorbackup repeatedly.       */
-/* Whenever a generation is finished, it checks for periodicity,        */
-/* printing the pattern if appropriate; otherwise it calls              */
-/* listneighbors to set things up for computing the next generation.    */
+/* Checkpoints.  Between two calls of computecellorbackup, the search   */
+/* position (settinglist, chglist and the pointers into them, bkgd,     */
+/* curr, naysum, the hash table slot by slot, the random number state,  */
+/* how far a path has been replayed, the split piece we're in, and the  */
+/* counters, including the hash statistics) can be written to a file.   */
+/* A later run given the same commands plus "resume <file>"             */
+/* reads it back and continues exactly where the first one left off,    */
+/* down to the statistics it prints.  Pointers are saved as offsets.    */
 /************************************************************************/
 
-int main(int argc, char *argv[])   /* fcn */
-{ int per, lines, i, g;
-  unsigned long int h;
-  char buff[500];
-  boolean semifzl, toomanytwos, pervar111;
-  point *p;
+#define CKPTMAGIC   "dr checkpoint 11"
 
-  setrule("B3/S23");
-  initarrays();
-  nwstng = settinglist;
-  chgd[0] = nays[0] = chglist;
+volatile sig_atomic_t termsignal;   /* Set when SIGTERM arrives */
 
-  /* Read command line arguments */
-  if (argc==1)
-    printf("Type '?' for list of commands\n\n");
+void catchterm(int sig) /* fcn */
+{ (void) sig;
+  termsignal = TRUE;
+}
 
-  for (i=1; i<argc; i++)
-    docommand(argv[i], TRUE);
+/* -------------------------------------------------------------------- */
 
-  /* Read commands from standard input.  Input is ended by either */
-  /* an empty line or end of file.                                */
-  while (gets(buff) && buff[0])
-    docommand(buff, FALSE);
+#define ckptio(x,n) \
+  if ((writing ? fwrite(x, sizeof(*(x)), n, f) \
+               : fread(x, sizeof(*(x)), n, f)) != (size_t) (n)) \
+    err1("Error in checkpoint file %s", fname)
+
+#define ckptcheck(x,n) \
+  { memcpy(saved, x, sizeof(*(x))*(n)); \
+    ckptio(saved, sizeof(*(x))*(n)); \
+    if (memcmp(saved, x, sizeof(*(x))*(n))) \
+      err1("Checkpoint file %s is for a different search", fname) \
+  }
+
+void checkpointio(FILE *f, char *fname, boolean writing)   /* fcn */
+/* Write the search position to f, or read it back from f.  The
+   starting position and rule must be the same as when it was written.
+*/
+{ char magic[sizeof(CKPTMAGIC)];
+  long int check[11], offset[3], count, i;
+  char saved[sizeof(check)];
+  fingerprint h;
+  int g, r;
+  setting *st;
+  searchstate *m = S->master;
+
+  strcpy(magic, CKPTMAGIC);
+  ckptio(magic, sizeof(magic));
+  if (strcmp(magic, CKPTMAGIC))  err1("%s isn't a checkpoint file", fname);
+
+  check[0] = S->HT;
+  check[1] = S->WD;
+  check[2] = S->SYMM;
+  check[3] = S->nays[0]-S->chglist;
+  check[4] = S->chgd[1]-S->chglist;
+  check[5] = S->forcedlth;      /* The path, split or frontier commands */
+  check[6] = S->splitindex;
+  check[7] = S->splitcount;
+  check[8] = S->splitdepth;
+  check[9] = S->samplecalls;
+  check[10] = S->numpieces;
+  ckptcheck(check, 11)
+  ckptcheck(S->rules->rule[0], 18)
+  for (i=0; i<S->forcedlth; i++)
+    ckptcheck(&S->forcedpath[i], 1)
+
+  offset[0] = S->nay-S->chglist;
+  offset[1] = S->chg-S->chglist;
+  offset[2] = S->nwstng-S->settinglist;
+  ckptio(offset, 3);
+  S->nay = S->chglist + offset[0];
+  S->chg = S->chglist + offset[1];
+  S->nwstng = S->settinglist + offset[2];
+
+  ckptio(&S->gen, 1);
+  ckptio(&S->found, 1);
+  ckptio(&S->next, 1);
+  ckptio(&S->countcomporbackuplo, 1);
+  ckptio(&S->countcomporbackuphi, 1);
+  ckptio(&S->countnodes, 1);
+  ckptio(&m->maxgenreached, 1);
+  ckptio(&S->countreplay, 1);
+  ckptio(&S->forcedpos, 1);     /* How much of the path has been replayed */
+  ckptio(&S->piece, 1);
+  ckptio(&S->piecedepth, 1);
+
+  for (g=0; g<=S->gen; g++)
+    { offset[0] = S->chgd[g]-S->chglist;
+      offset[1] = S->nays[g]-S->chglist;
+      ckptio(offset, 2);
+      S->chgd[g] = S->chglist + offset[0];
+      S->nays[g] = S->chglist + offset[1];
+    }
+  ckptio(S->chgcount, S->gen+1);
+  ckptio(S->width, S->gen+1);
+  ckptio(S->height, S->gen+1);
+  ckptio(S->agesm, S->gen+1);
+  ckptio(S->chglist, S->chg-S->chglist);
+  ckptio(&S->chgstat, 1);
+
+  if (!writing)  S->depth = 0;
+  for (st=S->settinglist; st<S->nwstng; st++)
+    { ckptio(&st->row, 1);
+      ckptio(&st->col, 1);
+      ckptio(&st->val, 1);
+      ckptio(&st->free, 1);
+      ckptio(&st->gen, 1);
+      ckptio(&S->settingstat[st - S->settinglist], 1);
+      offset[0] = st->nay-S->chglist;
+      offset[1] = st->chg-S->chglist;
+      ckptio(offset, 2);
+      st->nay = S->chglist + offset[0];
+      st->chg = S->chglist + offset[1];
+      if (st->free)  S->depth += !writing;
+    }
 
-  /* Print info about search */
-  printf("Reading file '%s'\n",knownrotorsfilename);
-  fflush(stdout);
-  lines = readknownrotors();
-  printf("%d known rotors read\n\n",lines);
-  fflush(stdout);
-
-  printf("Max height of changed region = %d\n", maxheight);
-  printf("Max width of changed region = %d\n", maxwidth);
-  printf("Max number of changed cells = %d\n", maxchng);
-  printf("Probability = %d\n", prob);
-
-  if (SKIPSTABLE)  printf("Skipping stable outcomes\n");
-  if (NOPICS)      printf("Not showing pictures\n");
-  if (SKIPFIZZLE)  printf("Skipping fizzle outcomes\n");
-  if (SHOWFIN)     printf("Showing finished patterns\n");
-  if (SHOWALL)     printf("Showing all gens\n");
-
-  printf("Height = %d\n", HT);
-  printf("Width = %d\n", WD);
-
-  if (SYMM==HORSYMM)            printf("Horizontal symmetry\n");
-  else if (SYMM==VERTSYMM)      printf("Vertical symmetry\n");
-  else if (SYMM==DIAGSYMM)      printf("Diagonal symmetry\n");
-  else if (SYMM==ROT90SYMM)     printf("90 degree rotational symmetry\n");
-  else if (SYMM==ROT180SYMM)    printf("180 degree rotational symmetry\n");
-  else if (SYMM==PLUSSYMM)      printf("Horizontal & vertical symmetry\n");
-  else if (SYMM==XSYMM)         printf("Symmetry across both diagonals\n");
-  else if (SYMM==FULLSYMM)      printf("Full symmetry\n");
+  for (r=0; r<S->HT; r++)
+    { ckptio(S->bkgd[r], S->WD);
+      ckptio(S->curr[r], S->WD);
+      ckptio(S->naysum[r], S->WD);
+    }
 
-  /* Check squareness for some symmetries */
-  if (HT != WD &&
-      (SYMM==DIAGSYMM || SYMM==ROT90SYMM || SYMM==XSYMM || SYMM==FULLSYMM))
-    err("Symmetry requires height=width");
+  if (!writing)     /* Rebuild changedin from the lists of changes */
+    { memset(S->changedin[0], 0, gridbytes(S, S->changedin));
+      for (g=0; g<S->gen; g++)
+        markchanges(S->chgd[g], S->nays[g], g, TRUE);
+      if (!S->found)  markchanges(S->chgd[S->gen], S->chg, S->gen, TRUE);
+    }
 
-  nwstng = settinglist;     /* Make initialization un-backup-able */
-  changecurr(curr, 0);      /* Change curr to gen 0 */
+  /* Each fingerprint goes back into the slot it came from, so later
+     lookups probe exactly as many slots as they would have.
+  */
+  ckptio(&m->hashlookups, 1);
+  ckptio(&m->hashprobes, 1);
+  offset[0] = m->hashsize;
+  offset[1] = m->hashcount;
+  ckptio(offset, 2);
+  if (writing)
+    { for (i=0; i<m->hashsize; i++)
+        if (m->hashtable[i].lo || m->hashtable[i].hi)
+          { ckptio(&i, 1);
+            ckptio(&m->hashtable[i], 1);
+          }
+    }
+  else
+    { hashinit(m, offset[0]);
+      for (count=0; count<offset[1]; count++)
+        { ckptio(&i, 1);
+          ckptio(&h, 1);
+          if (i < 0 || i >= m->hashsize)
+            err1("Error in checkpoint file %s", fname);
+          m->hashtable[i] = h;
+        }
+      m->hashcount = offset[1];
+    }
+}
 
-  found = FALSE;
-  listneighbors(0); /* Init list at nays[0], chgd[1] */
-  nay = nays[0];
-  chg = chgd[gen = 1];
-  hashcount=0;
-  findchgcount(0);
+/* -------------------------------------------------------------------- */
 
-  display(0);
-  printf("Beginning search\n");
+void writecheckpoint(void)  /* fcn */
+/* Write the search position to the checkpoint file.  It goes to a
+   temporary file first, which is then renamed, so the previous
+   checkpoint survives if we're killed while writing.
+*/
+{ char tmpname[110];
+  FILE *f;
+
+  sprintf(tmpname, "%s.tmp", S->checkpointfile);
+  if (!(f = fopen(tmpname, "wb")))
+    err1("Can't write checkpoint file %s", tmpname);
+  checkpointio(f, tmpname, TRUE);
+  if (fflush(f) || fsync(fileno(f)) || fclose(f) ||
+      rename(tmpname, S->checkpointfile))
+    err1("Error writing checkpoint file %s", S->checkpointfile);
+
+  S->checkpointdue = FALSE;
+  if (S->checkpointsecs)  S->nextcheckpoint = time(NULL) + S->checkpointsecs;
+}
 
-  while (computecellorbackup() == OK)
-    { if (countcomporbackuplo == 0 &&
-	       (countcomporbackuphi<50 || countcomporbackuphi%10 == 0))
-        { printf("computecellorbackup calls: %d 000000\n",
-		    countcomporbackuphi);
-			display(0);		/* Temporary zzz */
-		  dispchgcts(gen-1);		/* Added 5/1/2008 */
-		  fflush(stdout);
-		}
+/* -------------------------------------------------------------------- */
 
-#if COUNT
-if (countcomporbackuplo == 0)  printcounts();
-if (TRACE)  {printf("back from computecellorbackup()\n");fflush(stdout);}
+void readcheckpoint(void)   /* fcn */
+/* Continue the search from the position in the resume file. */
+{ FILE *f;
+
+  if (!(f = fopen(S->resumefile, "rb")))
+    err1("Can't open checkpoint file %s", S->resumefile);
+  checkpointio(f, S->resumefile, FALSE);
+  fclose(f);
+  fprintf(S->out, "Resuming from %s after %ld %06ld computecellorbackup calls\n",
+    S->resumefile, S->countcomporbackuphi, S->countcomporbackuplo);
+  fflush(S->out);
+}
+
+/************************************************************************/
+/* The search loop.  search() calls computecellorbackup repeatedly.     */
+/* Whenever a generation is finished, it checks for periodicity,        */
+/* printing the pattern if appropriate; otherwise it calls              */
+/* listneighbors to set things up for computing the next generation.    */
+/************************************************************************/
+
+#if THREADS
+#define lockoutput()    flockfile(S->out)   /* Keep each result together */
+#define unlockoutput()  funlockfile(S->out)
+void donate(void);
+#else
+#define lockoutput()
+#define unlockoutput()
 #endif
 
-      if (nay == chgd[gen])     /* Done with this gen? */
-        { if (gen>maxgenreached)
-            { printf("maxgenreached = %d\n", maxgenreached=gen);
-			  dispchgcts(gen-1);
-              display(0);
-			  fflush(stdout);
-            }
-          nays[gen] = chg;
-		  findchgcount(gen);
-          changecurr(curr, gen-1);
-          changecurr(curr, gen);
-
-          if (var[110] && gen>=var[110])
-	        { for (g=gen-var[110], toomanytwos=TRUE; g<=gen; g++)
-		        if (chgcount[g] != 2) { toomanytwos=FALSE; break; }
-			  if (toomanytwos)
-				{ found=TRUE;
-				  printf("Too many 2s\n");
-				  gen++;
-				  continue;
-				}
-	        }
-
-		  if (var[121] && gen==var[121] && chgcount[gen]==var[122])
-            { found=TRUE;
-              printf("chgcount[%d] can't be %d\n",gen,var[122]);
-              gen++;
-              continue;
-            }
+void addresult(char kind, int per, int g)    /* fcn */
+/* If results are being kept, queue one for drnextresult, with the rotor
+   descriptor and name that printoscinfo printed last.
+*/
+{ drresult *r;
+  searchstate *m = S->master;
+
+  if (!m->keepresults)  return;
+  if (kind == 'm')  *S->rotordesc = 0, S->rotorname = NULL;
+  if (!(r = malloc(sizeof(drresult) + strlen(S->rotordesc))))
+    err("Out of memory in addresult()");
+  r->link = NULL;
+  r->kind = kind;
+  r->period = per;
+  r->gen = g;
+  r->name = S->rotorname;
+  strcpy(r->rotor, S->rotordesc);
+  *m->lastresult = r;
+  m->lastresult = &r->link;
+}
 
-		  if (var[123])
-			if (gen<var[123] && chgcount[gen]!=var[124])
-              { found=TRUE;
-                gen++;
-                continue;
-              }
-			else if (gen==var[123] && chgcount[gen]==var[124])
-              { found=TRUE;
-                printf("chgcount[%d] can't be %d\n",gen,var[124]);
-                gen++;
-                continue;
-              }
+/* -------------------------------------------------------------------- */
 
-		  if (gen<numcc &&
-			  ((reqchgcount[gen] >= 0 &&
-									nays[gen]-chgd[gen] != reqchgcount[gen]) ||
-			   (reqchgcount[gen] < 0 &&
-									nays[gen]-chgd[gen] == -reqchgcount[gen])))
-			{ found=TRUE;
-			  /*printf("Enforcing chgcount[%d] = %d\n",gen,reqchgcount[gen]);*/
-			  gen++;
-			  continue;
-			}
-
-		  if (var[128] && gen>=var[128] &&
-			   !(chgcount[gen] == chgcount[gen-var[128]] &&
-				 ((width[gen] == width[gen-var[128]] &&
-					 height[gen] == height[gen-var[128]]) ||
-				  (width[gen] == height[gen-var[128]] &&
-					 height[gen] == width[gen-var[128]]))))
-			{ found=TRUE;
-			  gen++;
-			  continue;
-			}
-
-		  if (var[116] && gen>=18 && chgcount[gen]==1 &&
-		    chgcount[gen-1]==3 && chgcount[gen-2]==3 && chgcount[gen-3]==5 &&
-			chgcount[gen-4]==6 && chgcount[gen-5]==4 && chgcount[gen-6]==4 &&
-			chgcount[gen-7]==4 && chgcount[gen-8]==3 && chgcount[gen-9]==1 &&
-			chgcount[gen-10]==3 && chgcount[gen-11]==3 &&
-			chgcount[gen-12]==5 && chgcount[gen-13]==6 &&
-			chgcount[gen-14]==4 && chgcount[gen-15]==4 &&
-			chgcount[gen-16]==4 && chgcount[gen-17]==3 &&
-			chgcount[gen-18]==1)
-            { found=TRUE;
-              printf("5c/9 continues too long\n");
-              gen++;
-              continue;
-            }
+void newmaxgen(void)    /* fcn */
+/* Called when gen is finished and is past genseen.  If it's past
+   maxgenreached, which another thread may have raised meanwhile, make it
+   the new one and report it.
+*/
+{ searchstate *m = S->master;
 
-          if (var[111] && gen >= var[111])
-            { for (p=chgd[gen-var[111]], pervar111=TRUE;
-                   p<nays[gen-var[111]];   p++)
-                if (p->row >= var[132] && p->col >= var[133] &&
-				    p->row <= var[134] && p->col <= var[135] &&
-					bkgd[p->row][p->col] == curr[p->row][p->col])
-                  { pervar111=FALSE; break; }
-			  if (!pervar111)
-				{ found=TRUE;
-				  gen++;
-				  continue;
-				}
-			}
-
-		  if (var[120] && chgcount[gen] && chgcount[gen]<var[120])
-            { found=TRUE;
-              /* printf("Change count too small\n"); */
-              gen++;
-              continue;
+#if THREADS
+  pthread_mutex_lock(&m->worklock);
+#endif
+  if (S->gen > m->maxgenreached)
+    { lockoutput();
+      fprintf(S->out, "maxgenreached = %d\n", m->maxgenreached = S->gen);
+      dispchgcts(S->gen-1);
+      display(0);
+      fflush(S->out);
+      unlockoutput();
+    }
+  S->genseen = m->maxgenreached;
+#if THREADS
+  pthread_mutex_unlock(&m->worklock);
+#endif
+}
+
+/* -------------------------------------------------------------------- */
+
+boolean search(long int n)  /* fcn */
+/* Run the search from the current position for up to n calls to
+   computecellorbackup, or until no more free choices are left to back
+   up to if n is negative.  Return TRUE if the search is finished.
+*/
+{ int per, g;
+  fingerprint h;
+  boolean semifzl;
+  boolean (**check)(void);
+
+  while (n < 0 || n-- > 0)
+    { if (S->master->failed)  return TRUE;  /* Another thread hit an error */
+      if (S->checkpointdue || (termsignal && *S->checkpointfile))
+        { writecheckpoint();
+          if (termsignal)
+            { fprintf(S->out, "Terminated; checkpoint written to %s\n",
+                S->checkpointfile);
+              fflush(S->out);
+              S->stopped = TRUE;
+              return FALSE;
             }
+        }
+
+      if (computecellorbackup() != OK)  return TRUE;
+
+      if (S->newmillion && !S->sampling &&
+	       (S->countcomporbackuphi<50 || S->countcomporbackuphi%10 == 0))
+        { lockoutput();
+		  fprintf(S->out, "computecellorbackup calls: %ld 000000\n",
+		    S->countcomporbackuphi);
+			display(0);		/* Temporary zzz */
+		  dispchgcts(S->gen-1);		/* Added 5/1/2008 */
+		  fflush(S->out);
+		  unlockoutput();
+		}
+
+#if THREADS
+      if (S->master->idlethreads && (S->countcomporbackuplo & 1023) == 0)
+        donate();
+#endif
 
+      if (S->newmillion && S->checkpointcalls &&
+          S->countcomporbackuphi % S->checkpointcalls == 0)
+        S->checkpointdue = TRUE;
+      if (S->checkpointsecs && (S->countcomporbackuplo & 1023) == 0 &&
+          time(NULL) >= S->nextcheckpoint)
+        S->checkpointdue = TRUE;
 
-          h = hash();
+#if COUNT
+if (S->newmillion)  printcounts();
+if (TRACE)  {fprintf(S->out, "back from computecellorbackup()\n");
+             fflush(S->out);}
+#endif
+      S->newmillion = FALSE;
+
+      if (S->nay == S->chgd[S->gen])     /* Done with this gen? */
+        { if (S->gen>S->genseen && !S->sampling)  newmaxgen();
+          S->nays[S->gen] = S->chg;
+		  findchgcount(S->gen);
+          changecurr(S->curr, S->gen-1);
+          changecurr(S->curr, S->gen);
+
+          for (check=S->genchecks; *check; check++)
+            if ((*check)())  break;
+          if (*check)
+            { S->found=TRUE;
+              S->gen++;
+              continue;
+            }
 
-          if (nays[gen] == chgd[gen])
-            { found = TRUE;
-              if (hashnew(h))
-                if (!SKIPFIZZLE)
-                  { printf("*****  Fizzle at gen %d\n",gen);
-					printoscinfo(gen, 'f');
-					dispchgcts(gen);
+          if (S->nays[S->gen] == S->chgd[S->gen])
+            { S->found = TRUE;
+              h = hash();
+              if (ownresult() && hashnew(h))
+                if (!S->SKIPFIZZLE)
+                  { lockoutput();
+					fprintf(S->out, "*****  Fizzle at gen %d\n",S->gen);
+					printoscinfo(S->gen, 'f');
+					addresult('f', 0, S->gen);
+					dispchgcts(S->gen);
                     display(0);
-					if (SHOWALL)
-					  for (g=1; g<=gen; g++)  display(g);
+					if (S->SHOWALL)
+					  for (g=1; g<=S->gen; g++)  display(g);
+					unlockoutput();
                   }
             }
 
           else if (per = period())
-            { found = TRUE;
+            { S->found = TRUE;
               semifzl = semifizzle();
-              if (hashnew(h))
+              h = hash();
+              if (ownresult() && hashnew(h))
                 if (per>1)
-                  { if (var[131] && per==3)
-				      hashcount--;			/* Forget about p3 stuff */
+                  { lockoutput();
+					if (S->var[131] && per==3)
+				      hashforget(h);		/* Forget about p3 stuff */
 					else
-				      { printf("*****  Period %d at gen %d%s\n",
-                          per, gen-per, semifzl ? " (semifizzle)" : "");
+				      { fprintf(S->out, "*****  Period %d at gen %d%s\n",
+                          per, S->gen-per, semifzl ? " (semifizzle)" : "");
                         printoscinfo(per, 'p');
-                        printoscinfo(gen, 'u');
-					    dispchgcts(gen);
+                        addresult('p', per, S->gen-per);
+                        printoscinfo(S->gen, 'u');
+					    dispchgcts(S->gen);
 					  }
-					if (!var[131] || per>6)
+					if (!S->var[131] || per>6)
 					  display(0);
-                    if (SHOWFIN)  display(gen);
-					if (SHOWALL)
-					  for (g=1; g<=gen; g++)  display(g);
+                    if (S->SHOWFIN)  display(S->gen);
+					if (S->SHOWALL)
+					  for (g=1; g<=S->gen; g++)  display(g);
+					unlockoutput();
                   }
                 else
-                  if (semifzl || !SKIPSTABLE)
-                    { printf("*****  Stable at gen %d%s\n",
-                        gen-1, semifzl ? " (semifizzle)" : "");
-                      printoscinfo(gen, 's');
-					  dispchgcts(gen);
+                  if (semifzl || !S->SKIPSTABLE)
+                    { lockoutput();
+					  fprintf(S->out, "*****  Stable at gen %d%s\n",
+                        S->gen-1, semifzl ? " (semifizzle)" : "");
+                      printoscinfo(S->gen, 's');
+                      addresult('s', 1, S->gen-1);
+					  dispchgcts(S->gen);
                       display(0);
-                      if (SHOWFIN)  display(gen);
-					  if (SHOWALL)
-					    for (g=1; g<=gen; g++)  display(g);
+                      if (S->SHOWFIN)  display(S->gen);
+					  if (S->SHOWALL)
+					    for (g=1; g<=S->gen; g++)  display(g);
+					  unlockoutput();
                     }
             }
 
-          else if (gen == MAXGEN)
-            { found = TRUE;
-              if (hashnew(h))
-                { printf("*****  Max gen (%d) reached\n", MAXGEN);
-					dispchgcts(gen);
+          else if (S->gen == MAXGEN)
+            { S->found = TRUE;
+              h = hash();
+              if (ownresult() && hashnew(h))
+                { lockoutput();
+				  fprintf(S->out, "*****  Max gen (%d) reached\n", MAXGEN);
+				  addresult('m', 0, MAXGEN);
+					dispchgcts(S->gen);
                   display(0);
-                  if (SHOWFIN)  display(gen);
-				  if (SHOWALL)
-					for (g=1; g<=gen; g++)  display(g);
+                  if (S->SHOWFIN)  display(S->gen);
+				  if (S->SHOWALL)
+					for (g=1; g<=S->gen; g++)  display(g);
+				  unlockoutput();
                 }
             }
 
           else
-            { listneighbors(gen);
-              nay = nays[gen];
-              chg = chgd[gen+1];
+            { listneighbors(S->gen);
+              S->nay = S->nays[S->gen];
+              S->chg = S->chgd[S->gen+1];
             }
 
-          gen++;
-		  if (var[129])  agesm[gen] = 0;
+          S->gen++;
+		  if (S->var[129])  S->agesm[S->gen] = 0;
+        }
+    }
+
+  return FALSE;
+}
+
+/************************************************************************/
+/* The following functions cut the search tree into pieces for the      */
+/* split command.  Each piece is searched for up to samplecalls calls.  */
+/* Starting with the whole tree, the shallowest piece that isn't        */
+/* finished in that time is cut in two at its first free choice, until  */
+/* there are 8 pieces per part.  The finished pieces, whose sizes are   */
+/* then known, are given to the parts biggest first, each to the part   */
+/* with the least so far.  The unfinished ones can't be sized from a    */
+/* sample (one subtree may hold most of the tree), so they're shared:   */
+/* each is cut again at depth splitdepth, and the subtrees there go to  */
+/* the parts by a hash of their paths.  The sampling depends only on    */
+/* the commands, so every part cuts the tree the same way without       */
+/* talking to the others.                                               */
+/************************************************************************/
+
+void restorestart(void) /* fcn */
+/* Copy the starting position into this thread's searchstate.  It's kept
+   in the master, which leaves its position alone until the threads are
+   done.  Also used by samplepiece.
+*/
+{ searchstate *m = S->master;
+
+  memcpy(S->bkgd[0], m->bkgd[0], gridbytes(S, S->bkgd));
+  memcpy(S->curr[0], m->curr[0], gridbytes(S, S->curr));
+  memcpy(S->naysum[0], m->naysum[0], gridbytes(S, S->naysum));
+  memcpy(S->changedin[0], m->changedin[0], gridbytes(S, S->changedin));
+  memcpy(S->chglist, m->chglist, (m->chgd[1]-m->chglist)*sizeof(point));
+
+  memset(S->chgcount, 0, sizeof(S->chgcount));
+  memset(S->width, 0, sizeof(S->width));
+  memset(S->height, 0, sizeof(S->height));
+  memset(S->agesm, 0, sizeof(S->agesm));
+  S->chgcount[0] = m->chgcount[0];
+  S->width[0] = m->width[0];
+  S->height[0] = m->height[0];
+  S->agesm[0] = m->agesm[0];
+
+  S->chgd[0] = S->chglist;
+  S->nays[0] = S->nay = S->chglist + (m->nays[0]-m->chglist);
+  S->chgd[1] = S->chg = S->chglist + (m->chgd[1]-m->chglist);
+  S->gen = 1;
+  S->nwstng = S->settinglist;
+  S->depth = 0;
+  S->piecedepth = INT_MAX;
+  S->found = FALSE;
+}
+
+/* -------------------------------------------------------------------- */
+
+long int samplepiece(searchstate *t, splitpiece *p) /* fcn */
+/* Search piece p for up to samplecalls calls in t.  Return the calls
+   made, counting those that replay its path.
+*/
+{ long int calls;
+
+  S = t;
+  restorestart();
+  for (t->forcedlth=0; p->path[t->forcedlth]; t->forcedlth++)
+    t->forcedpath[t->forcedlth] = p->path[t->forcedlth] - '0';
+  t->forcedpos = 0;
+  t->countcomporbackuphi = t->countcomporbackuplo = t->countreplay = 0;
+  do
+    { p->finished = search(1000);
+      calls = 1000000*t->countcomporbackuphi + t->countcomporbackuplo;
+    }
+  while (!p->finished && calls < t->samplecalls);
+  p->splittable = !p->finished && t->depth > t->forcedlth;
+  p->calls = calls;
+  S = t->master;
+  return calls + t->countreplay;
+}
+
+/* -------------------------------------------------------------------- */
+
+int comparesize(const void *a, const void *b)   /* fcn */
+/* For sorting pieces finished ones first, biggest first, and by path if
+   they're the same.
+*/
+{ const splitpiece *p = a, *q = b;
+
+  if (p->finished != q->finished)  return p->finished ? -1 : 1;
+  if (p->calls != q->calls)  return p->calls < q->calls ? 1 : -1;
+  return strcmp(p->path, q->path);
+}
+
+int comparepath(const void *a, const void *b)   /* fcn */
+/* For sorting pieces by path. */
+{ return strcmp(((const splitpiece *) a)->path,
+                ((const splitpiece *) b)->path);
+}
+
+/* -------------------------------------------------------------------- */
+
+void cutpieces(void)    /* fcn */
+/* Cut the search tree into pieces for split K/N, and decide which part
+   searches each.
+*/
+{ searchstate *t;
+  splitpiece *p, *q;
+  long int calls, total, *load;
+  int maxpieces = 8*S->splitcount, shared, i, k, lth;
+
+  if (!(t = malloc(sizeof(searchstate))) ||
+      !(S->pieces = malloc(maxpieces*sizeof(splitpiece))) ||
+      !(S->pieces[0].path = malloc(1)) ||
+      !(load = calloc(S->splitcount, sizeof(long int))))
+    err("Out of memory in cutpieces()");
+  memcpy(t, S, sizeof(searchstate));    /* Same parameters */
+  if (!(t->forcedpath = malloc(S->HT*S->WD)))
+    err("Out of memory in cutpieces()");
+  newgrids(t, FALSE);
+  if (S->nogoods)  nogoodinit(t);
+  t->sampling = TRUE;
+  t->splitcount = t->splitdepth = 0;
+  *t->checkpointfile = 0;
+  t->checkpointcalls = t->checkpointsecs = 0;
+
+  *S->pieces[0].path = 0;
+  calls = samplepiece(t, &S->pieces[0]);
+  S->numpieces = 1;
+  while (S->numpieces < maxpieces)
+    { for (i=0, p=NULL; i<S->numpieces; i++)
+        if (S->pieces[i].splittable &&
+            (!p || strlen(S->pieces[i].path) < strlen(p->path)))
+          p = &S->pieces[i];
+      if (!p)  break;
+
+      q = &S->pieces[S->numpieces++];   /* Cut p at its first free choice */
+      lth = strlen(p->path);
+      if (!(q->path = malloc(lth+2)) || !(p->path = realloc(p->path, lth+2)))
+        err("Out of memory in cutpieces()");
+      strcpy(q->path, p->path);
+      strcpy(p->path+lth, "0");
+      strcpy(q->path+lth, "1");
+      calls += samplepiece(t, p);
+      calls += samplepiece(t, q);
+    }
+
+  qsort(S->pieces, S->numpieces, sizeof(splitpiece), comparesize);
+  for (i=shared=0, total=0; i<S->numpieces; i++)
+    if (!S->pieces[i].finished)
+      { S->pieces[i].owner = -1;
+        shared++;
+      }
+    else
+      { for (k=0, S->pieces[i].owner=0; k<S->splitcount; k++)
+          if (load[k] < load[S->pieces[i].owner])  S->pieces[i].owner = k;
+        load[S->pieces[i].owner] += S->pieces[i].calls;
+        total += S->pieces[i].calls;
+      }
+  qsort(S->pieces, S->numpieces, sizeof(splitpiece), comparepath);
+  S->piecedepth = INT_MAX;
+
+  fprintf(S->out, "Sampled %ld calls; cut into %d pieces, %d shared; "
+    "%ld of the %ld calls in the others are in this part\n",
+    calls, S->numpieces, shared, load[S->splitindex], total);
+  freegrids(t, FALSE);
+  free(t->nogoods);
+  free(t->forcedpath);
+  free(t);
+  free(load);
+}
+
+#if THREADS
+/************************************************************************/
+/* The following functions split the search among several threads.     */
+/* Each thread has its own searchstate; only the hash table, the        */
+/* results and the output, which belong to the master searchstate, are  */
+/* shared.  A piece of work is a subtree of the search tree, given by   */
+/* the values of the free choices leading to it.  Initially one thread  */
+/* gets the whole tree.  When a thread runs out of work, a busy thread  */
+/* gives away the alternative of its earliest remaining free choice,    */
+/* which is usually the biggest unexplored subtree it has.  The thread  */
+/* that receives it starts from the initial position and replays the    */
+/* choices (not counting those calls to computecellorbackup) before     */
+/* continuing on its own.                                               */
+/************************************************************************/
+
+void addwork(workitem *w)   /* fcn */
+/* Put w on the list of subtrees to be searched. */
+{ searchstate *m = S->master;
+
+  pthread_mutex_lock(&m->worklock);
+  w->link = m->worklist;
+  m->worklist = w;
+  pthread_cond_signal(&m->workcond);
+  pthread_mutex_unlock(&m->worklock);
+}
+
+/* -------------------------------------------------------------------- */
+
+workitem *getwork(void) /* fcn */
+/* Wait for a subtree to search.  Return NULL if the search is finished. */
+{ searchstate *m = S->master;
+  workitem *w;
+
+  pthread_mutex_lock(&m->worklock);
+  while (!m->worklist && m->busythreads)
+    { m->idlethreads++;
+      pthread_cond_wait(&m->workcond, &m->worklock);
+      m->idlethreads--;
+    }
+  if ((w = m->failed ? NULL : m->worklist))
+    { m->worklist = w->link;
+      m->busythreads++;
+      m->numsubtrees++;
+    }
+  pthread_mutex_unlock(&m->worklock);
+  return w;
+}
+
+/* -------------------------------------------------------------------- */
+
+void donework(void) /* fcn */
+/* Called when a thread finishes its subtree. */
+{ searchstate *m = S->master;
+
+  pthread_mutex_lock(&m->worklock);
+  if (--m->busythreads == 0 && !m->worklist)
+    pthread_cond_broadcast(&m->workcond);     /* Everybody's done */
+  pthread_mutex_unlock(&m->worklock);
+}
+
+/* -------------------------------------------------------------------- */
+
+void donate(void)   /* fcn */
+/* Give the alternative of the earliest free choice to an idle thread. */
+{ setting *s, *t;
+  workitem *w;
+
+  for (s=S->settinglist; s<S->nwstng && s->free != TRUE; s++);
+  if (s == S->nwstng)  return;  /* Nothing to give */
+
+  w = malloc(sizeof(workitem) + (s-S->settinglist));
+  if (!w)  err("Out of memory in donate()");
+  for (t=S->settinglist, w->lth=0; t<=s; t++)
+    if (t->free)  w->path[w->lth++] = t->val;
+  w->path[w->lth-1] ^= 1;
+  s->free = FLIPPED;            /* Other thread will do the alternative */
+  addwork(w);
+}
+
+/* -------------------------------------------------------------------- */
+
+void *searchthread(void *arg)   /* fcn */
+/* Search subtrees until there are none left.  arg is the thread's
+   searchstate.
+*/
+{ searchstate *m;
+  workitem *w;
+  jmp_buf onerror;
+
+  S = arg;
+  m = S->master;
+  if (m->onerror)   /* Run from another program: after an error, stop */
+    { S->onerror = &onerror;    /* every thread, and let the master  */
+      if (setjmp(onerror))      /* return it                         */
+        { S = arg;
+          m->failed = TRUE;
+          donework();
         }
     }
+  while ((w = getwork()))
+    { restorestart();
+      S->forcedpath = w->path;
+      S->forcedlth = w->lth;
+      S->forcedpos = 0;
+      search(-1);
+      S->forcedlth = 0;
+      free(w);
+      donework();
+    }
+
+  pthread_mutex_lock(&m->worklock);
+  m->totalcomporbackup += 1000000*S->countcomporbackuphi +
+                          S->countcomporbackuplo;
+  m->totalreplay += S->countreplay;
+  m->totalnodes += S->countnodes;
+  m->totallearned += S->nogoodlearned;
+  m->totalhits += S->nogoodhits;
+  m->totalsaved += S->nogoodsaved;
+  pthread_mutex_unlock(&m->worklock);
+  return NULL;
+}
+
+/* -------------------------------------------------------------------- */
 
+void searchthreads(void)    /* fcn */
+/* Run the search in numthreads threads. */
+{ pthread_t *thread;
+  searchstate **state;
+  workitem *w;
+  int i;
+
+  if (!(w = malloc(sizeof(workitem) + S->forcedlth)) ||
+      !(thread = malloc(S->numthreads*sizeof(pthread_t))) ||
+      !(state = malloc(S->numthreads*sizeof(searchstate *))))
+    err("Out of memory in searchthreads()");
+  w->lth = S->forcedlth;        /* The whole search tree, or the subtree */
+  if (w->lth)                   /* given by the path command             */
+    memcpy(w->path, S->forcedpath, w->lth);
+  addwork(w);
+
+  for (i=0; i<S->numthreads; i++)
+    { if (!(state[i] = malloc(sizeof(searchstate))))
+        err("Out of memory in searchthreads()");
+      memcpy(state[i], S, sizeof(searchstate));     /* Same parameters */
+      newgrids(state[i], FALSE);
+      if (S->nogoods)  nogoodinit(state[i]);
+      state[i]->next = S->next + i;     /* Different random choices in */
+                                        /* each thread                 */
+    }
+  for (i=0; i<S->numthreads; i++)   /* Only once S has been copied, */
+    if (pthread_create(&thread[i], NULL, searchthread, state[i]))
+      err("Can't create thread");   /* since the threads change it  */
+  for (i=0; i<S->numthreads; i++)
+    { pthread_join(thread[i], NULL);
+      freegrids(state[i], FALSE);
+      free(state[i]->nogoods);
+      free(state[i]);
+    }
+  free(thread);
+  free(state);
+  while ((w = S->worklist))     /* Left over after an error */
+    { S->worklist = w->link;
+      free(w);
+    }
+  if (S->failed)  fail();
+
+  S->countcomporbackuphi = S->totalcomporbackup / 1000000;
+  S->countcomporbackuplo = S->totalcomporbackup % 1000000;
+  S->countnodes = S->totalnodes;
+  S->nogoodlearned = S->totallearned;
+  S->nogoodhits = S->totalhits;
+  S->nogoodsaved = S->totalsaved;
+  fprintf(S->out, "%d threads searched %ld subtrees, replaying %ld calls\n",
+    S->numthreads, S->numsubtrees, S->totalreplay);
+}
+#endif
+
+/************************************************************************/
+/* The functions that start and finish a search.  beginsearch first     */
+/* reads the known rotors file, unless some search has already read     */
+/* the same one, and prints the parameters.                             */
+/************************************************************************/
+
+void beginsearch(void)  /* fcn */
+{ int r, c;
+
+  S->known = getknownrotors();
+  fflush(S->out);
+
+  /* Print info about search */
+  fprintf(S->out, "Max height of changed region = %d\n", S->maxheight);
+  fprintf(S->out, "Max width of changed region = %d\n", S->maxwidth);
+  fprintf(S->out, "Max number of changed cells = %d\n", S->maxchng);
+  fprintf(S->out, "Probability = %d\n", S->prob);
+
+  if (S->SKIPSTABLE)  fprintf(S->out, "Skipping stable outcomes\n");
+  if (S->NOPICS)      fprintf(S->out, "Not showing pictures\n");
+  if (S->SKIPFIZZLE)  fprintf(S->out, "Skipping fizzle outcomes\n");
+  if (S->SHOWFIN)     fprintf(S->out, "Showing finished patterns\n");
+  if (S->SHOWALL)     fprintf(S->out, "Showing all gens\n");
+  if (S->LOOKAHEAD)   fprintf(S->out, "Looking ahead\n");
+
+  fprintf(S->out, "Height = %d\n", S->HT);
+  fprintf(S->out, "Width = %d\n", S->WD);
+
+  switch (S->SYMM)
+    { case HORSYMM:     fprintf(S->out, "Horizontal symmetry\n");  break;
+      case VERTSYMM:    fprintf(S->out, "Vertical symmetry\n");  break;
+      case DIAGSYMM:    fprintf(S->out, "Diagonal symmetry\n");  break;
+      case ROT90SYMM:   fprintf(S->out, "90 degree rotational symmetry\n");
+                        break;
+      case ROT180SYMM:  fprintf(S->out, "180 degree rotational symmetry\n");
+                        break;
+      case PLUSSYMM:    fprintf(S->out, "Horizontal & vertical symmetry\n");
+                        break;
+      case XSYMM:       fprintf(S->out, "Symmetry across both diagonals\n");
+                        break;
+      case FULLSYMM:    fprintf(S->out, "Full symmetry\n");  break;
+    }
+  if (S->branchcell != FIRSTCELL || S->branchvalue != RANDOMVALUE)
+    fprintf(S->out, "Branching: %s cell, %s value\n",
+            branchcellname[S->branchcell], branchvaluename[S->branchvalue]);
+
+  /* Check squareness for some symmetries */
+  if (S->HT != S->WD &&
+      (S->SYMM==DIAGSYMM || S->SYMM==ROT90SYMM || S->SYMM==XSYMM ||
+       S->SYMM==FULLSYMM))
+    err("Symmetry requires height=width");
+
+  buildchecks();
+  if (S->nogoodsize && !S->nogoods)  nogoodinit(S);
+  initorbits();
+
+  S->nwstng = S->settinglist;   /* Make initialization un-backup-able */
+  changecurr(S->curr, 0);       /* Change curr to gen 0 */
+
+  S->startminr = S->HT;    S->startmaxr = -1;
+  S->startminc = S->WD;    S->startmaxc = -1;
+  for (r=2; r<S->HT-2; r++)
+    for (c=2; c<S->WD-2; c++)
+      if (S->bkgd[r][c] == ON)
+        { S->startminr = min(S->startminr, r);
+          S->startmaxr = max(S->startmaxr, r);
+          S->startminc = min(S->startminc, c);
+          S->startmaxc = max(S->startmaxc, c);
+        }
+
+  S->found = FALSE;
+  memset(S->changedin[0], 0, gridbytes(S, S->changedin));
+  markchanges(S->chgd[0], S->nays[0], 0, TRUE);
+  listneighbors(0); /* Init list at nays[0], chgd[1] */
+  S->nay = S->nays[0];
+  S->chg = S->chgd[S->gen = 1];
+  findchgcount(0);
+
+  display(0);
+  fprintf(S->out, "Beginning search\n");
+  S->started = TRUE;
+  if (S->splitcount)  cutpieces();
+
+  if ((*S->checkpointfile || *S->resumefile) && S->numthreads > 1)
+    err("Can't checkpoint a search that uses several threads");
+  if (*S->resumefile)  readcheckpoint();
+  if (*S->checkpointfile)
+    { signal(SIGTERM, catchterm);
+      S->nextcheckpoint = time(NULL) + S->checkpointsecs;
+    }
+}
+
+/* -------------------------------------------------------------------- */
+
+void endsearch(void)    /* fcn */
+{
 #if COUNT
   printcounts();
 #endif
 
-  printf("computecellorbackup calls: %d %06d\n",
-    countcomporbackuphi, countcomporbackuplo);
-  printf("No more objects\n");
+  fprintf(S->out, "computecellorbackup calls: %ld %06ld\n",
+    S->countcomporbackuphi, S->countcomporbackuplo);
+  fprintf(S->out, "Free choices (%s cell, %s value): %ld\n",
+    branchcellname[S->branchcell], branchvaluename[S->branchvalue],
+    S->countnodes);
+  if (S->nogoods)
+    fprintf(S->out, "Nogoods: %ld stored, %ld hits, %ld settings saved\n",
+      S->nogoodlearned, S->nogoodhits, S->nogoodsaved);
+  fprintf(S->out, "Hash table: %ld entries, load factor %.2f, "
+    "%.2f probes per lookup\n", S->master->hashcount,
+    (double) S->master->hashcount / S->master->hashsize,
+    S->master->hashlookups ?
+      (double) S->master->hashprobes / S->master->hashlookups : 0.);
+  fprintf(S->out, "No more objects\n");
+  fflush(S->out);
+  S->finished = TRUE;
+}
+
+/************************************************************************/
+/* The interface for other programs, declared in dr.h.                  */
+/************************************************************************/
+
+searchstate *drcreate(FILE *out)    /* fcn */
+{ searchstate *s;
+  jmp_buf onerror;
+
+  if (!(s = calloc(1, sizeof(searchstate))))  return NULL;
+  S = s;
+  s->HT = DEFHT;
+  s->WD = DEFWD;
+  s->SYMM = NOSYMM;
+  s->maxchng = 9;
+  s->maxwidth = 3;
+  s->maxheight = 3;
+  s->prob = 50;
+  strcpy(s->knownrotorsfilename, "knownrotors");
+  s->numthreads = 1;
+  s->out = out;
+  s->keepresults = TRUE;
+  s->next = 1;
+  s->master = s;
+  s->lastresult = &s->results;
+#if THREADS
+  pthread_mutex_init(&s->hashlock, NULL);
+  pthread_mutex_init(&s->worklock, NULL);
+  pthread_cond_init(&s->workcond, NULL);
+#endif
+
+  s->onerror = &onerror;    /* Only S from here on, which longjmp keeps */
+  if (setjmp(onerror))
+    { drfree(S);
+      return NULL;
+    }
+  hashinit(S, HASHTBLSIZE);
+  setrule("B3/S23");
+  initarrays();
+  S->onerror = NULL;
+  return S;
+}
+
+/* -------------------------------------------------------------------- */
+
+int drcommand(searchstate *s, char *cmd)    /* fcn */
+{ char buff[500], *p;
+  jmp_buf onerror;
+
+  S = s;
+  s->onerror = &onerror;
+  if (setjmp(onerror))
+    { S = s;
+      s->onerror = NULL;
+      s->patternsrc = NULL;
+      return -1;
+    }
+  if ((p = strchr(cmd, '\n')))    /* Pattern follows read command */
+    { if (p-cmd >= (long int) sizeof(buff))  err1("Command too long: %s", cmd);
+      memcpy(buff, cmd, p-cmd);
+      buff[p-cmd] = 0;
+      s->patternsrc = p+1;
+      docommand(buff, FALSE);
+      s->patternsrc = NULL;
+    }
+  else  docommand(cmd, FALSE);
+  s->onerror = NULL;
+  return 0;
 }
+
+/* -------------------------------------------------------------------- */
+
+int drrun(searchstate *s)   /* fcn */
+{ jmp_buf onerror;
+
+  S = s;
+  if (s->failed)  return -1;
+  if (s->finished)  return 0;
+  s->onerror = &onerror;
+  if (setjmp(onerror))
+    { S = s;
+      s->onerror = NULL;
+      s->failed = TRUE;
+      return -1;
+    }
+  if (!s->started)  beginsearch();
+
+#if THREADS
+  if (s->numthreads > 1 && !s->countcomporbackuplo && !s->countcomporbackuphi)
+    searchthreads();
+  else
+#endif
+  search(-1);
+
+  if (!s->stopped)  endsearch();
+  s->onerror = NULL;
+  return 0;
+}
+
+/* -------------------------------------------------------------------- */
+
+int drstep(searchstate *s, long int n)  /* fcn */
+{ jmp_buf onerror;
+
+  S = s;
+  if (s->failed)  return -1;
+  s->onerror = &onerror;
+  if (setjmp(onerror))
+    { S = s;
+      s->onerror = NULL;
+      s->failed = TRUE;
+      return -1;
+    }
+  if (!s->started)  beginsearch();
+  if (!s->finished && !s->stopped && search(n))  endsearch();
+  s->onerror = NULL;
+  return s->finished || s->stopped;
+}
+
+/* -------------------------------------------------------------------- */
+
+drresult *drnextresult(searchstate *s)  /* fcn */
+{ drresult *r;
+
+  free(s->returned);
+  if ((r = s->results))
+    if (!(s->results = r->link))  s->lastresult = &s->results;
+  return s->returned = r;
+}
+
+/* -------------------------------------------------------------------- */
+
+void drfree(searchstate *s) /* fcn */
+{ while (drnextresult(s))
+    ;
+  free(s->hashtable);
+  free(s->nogoods);
+  freegrids(s, TRUE);
+#if THREADS
+  pthread_mutex_destroy(&s->hashlock);
+  pthread_mutex_destroy(&s->worklock);
+  pthread_cond_destroy(&s->workcond);
+#endif
+  free(s);
+  if (S == s)  S = NULL;
+}
+
+#ifndef DRLIB
+/************************************************************************/
+/* The main program.  It creates a search and initializes things based  */
+/* on commands in the command line and standard input.  Then it runs    */
+/* the search, possibly in several threads.                             */
+/************************************************************************/
+
+int main(int argc, char *argv[])   /* fcn */
+{ int i;
+  char buff[500];
+
+  if (!(S = drcreate(stdout)))
+    { printf("\n\nOut of memory in drcreate()\n");
+      return 1;
+    }
+  S->keepresults = FALSE;
+
+  /* Read command line arguments */
+  if (argc==1)
+    printf("Type '?' for list of commands\n\n");
+
+  for (i=1; i<argc; i++)
+    if (!docommand(argv[i], TRUE))  return 0;
+
+  /* Read commands from standard input.  Input is ended by either */
+  /* an empty line or end of file.                                */
+  while (gets(buff) && buff[0])
+    if (!docommand(buff, FALSE))  return 0;
+
+  return drrun(S) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,69 @@
+/* Interface for running drifter searches from another program.
+
+   Compile dr.c with -DDRLIB to leave out main(), and link it with the
+   program.  Each search is a searchstate.  A program may run any number
+   of searches, one after another or at the same time in different
+   threads; they share the rule tables and the known rotors (each file
+   of them is read only once).  An error in a command or in the search
+   prints a message on the search's output and makes the function return
+   -1; nothing calls exit().
+
+   A typical use:
+
+     searchstate *s = drcreate(stdout);
+     drresult *r;
+
+     drcommand(s, "c6");
+     drcommand(s, "r10 10\n..o..\n.o.o.\n..o..!\n");
+     while (!drstep(s, 1000000))
+       while (r = drnextresult(s))
+         ...
+*/
+
+#ifndef DR_H
+#define DR_H
+
+#include <stdio.h>
+
+typedef struct searchstate searchstate;
+
+typedef struct drresult
+  { struct drresult *link;
+    char kind;          /* 'f' fizzle, 'p' periodic, 's' stable, */
+                        /* 'm' max gen reached                   */
+    int period;         /* Period, if kind is 'p' */
+    int gen;            /* Gen in which it was recognized, as printed */
+    char *name;         /* Name of known rotor, or NULL if unknown */
+    char rotor[1];      /* Rotor descriptor, as printed */
+  }  drresult;
+
+searchstate *drcreate(FILE *out);
+/* Create a search with the default parameters (rule B3/S23, 81x81
+   space, c9, h3, w3, P50).  Its messages, results and errors are
+   printed on out.  Return NULL if there's no memory. */
+
+int drcommand(searchstate *s, char *cmd);
+/* Do one command, as it would be typed to the program.  The pattern for
+   a read command ("r# #") follows the command after a newline, ending
+   with '!'.  If no pattern follows, it is read from standard input.
+   Return 0, or -1 if the command was bad (it may have been partly
+   done). */
+
+int drrun(searchstate *s);
+/* Run the search to the end, using T# threads.  Return 0, or -1 if
+   there was an error; the search can then only be freed. */
+
+int drstep(searchstate *s, long int n);
+/* Run the search for up to n more calls of computecellorbackup, in the
+   calling thread.  Return nonzero if the search is finished (or was
+   stopped by SIGTERM after writing a checkpoint): 1, or -1 if there was
+   an error, after which the search can only be freed. */
+
+drresult *drnextresult(searchstate *s);
+/* Return the oldest result not yet returned, or NULL if there are none.
+   The result is valid until the next call. */
+
+void drfree(searchstate *s);
+/* Free the search and its results. */
+
+#endif
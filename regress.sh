@@ -0,0 +1,139 @@
+#!/bin/sh
+# Regression test for dr.c.  Builds dr and runs the in.time sample search
+# (see dr.documentation.txt) in several ways that should find the same
+# results as the default search: with threads, split into parts, as the
+# subtrees listed by frontier, resumed from a checkpoint (also below a
+# path, where the call totals must agree as well), with lookahead
+# and with nogoods.  With canonhash it should find some of them.  Results
+# are compared as sets, since the order and the duplicates printed differ.
+# Run it from anywhere; it prints one line per check and exits nonzero if
+# any fails.
+
+cd "$(dirname "$0")" || exit 1
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+${CC:-cc} -O2 -o "$tmp/dr" dr.c -lpthread 2>"$tmp/cc.log" ||
+  { cat "$tmp/cc.log"; exit 1; }
+
+cat >"$tmp/in.time" <<'EOF'
+c3
+h3
+w3
+r24 24
+.ooooo
+o.....
+o.10oo
+o.o....
+o.o..oo
+o.o.o..!
+r36 37
+o.!
+EOF
+
+# run name command...: run the search with the given commands first
+run() {
+  name=$1
+  shift
+  for cmd
+  do
+    echo "$cmd"
+  done | cat - "$tmp/in.time" | "$tmp/dr" >"$tmp/$name.out"
+}
+
+# results file...: each result printed, on one line, without duplicates
+results() {
+  cat "$@" | awk '
+    /^\*\*\*\*\*/           { if (r != "") print r; r = $0; next }
+    r != "" && (/^Change counts/ || /^$/)   { print r; r = ""; next }
+    r != ""                 { split($0, f, "\t"); r = r "|" f[1] }
+    END                     { if (r != "") print r }' | sort -u
+}
+
+failed=0
+
+# check name file...: the results in the files must be those of the
+# default search
+check() {
+  name=$1
+  shift
+  results "$@" >"$tmp/$name.res"
+  if cmp -s "$tmp/default.res" "$tmp/$name.res"
+  then echo "ok    $name"
+  else echo "FAIL  $name"; failed=1
+  fi
+}
+
+run default
+results "$tmp/default.out" >"$tmp/default.res"
+if [ ! -s "$tmp/default.res" ]
+then echo "FAIL  default search found nothing"; exit 1
+fi
+echo "ok    default ($(wc -l <"$tmp/default.res") results)"
+
+run threads T4
+check threads "$tmp/threads.out"
+
+for n in 2 3 4
+do
+  k=0
+  while [ $k -lt $n ]
+  do
+    run split$n.$k "split $k/$n"
+    k=$((k+1))
+  done
+  check "split $n" "$tmp"/split$n.*.out
+done
+
+run frontier "frontier 8"
+for p in $(sed -n 's/^path //p' "$tmp/frontier.out")
+do
+  run path.$p "path $p"
+done
+check frontier "$tmp"/frontier.out "$tmp"/path.*.out
+
+# The checkpoint written after 1 million calls is the last one, so the
+# resumed search must print what the default one printed after that.
+run checkpoint "checkpoint $tmp/ckpt 1"
+check checkpoint "$tmp/checkpoint.out"
+run resume "resume $tmp/ckpt"
+sed -n '/^computecellorbackup calls: 1 000000/,$p' "$tmp/default.out" \
+  >"$tmp/tail.out"
+results "$tmp/tail.out" >"$tmp/tail.res"
+results "$tmp/resume.out" >"$tmp/resume.res"
+if [ -s "$tmp/tail.res" ] && cmp -s "$tmp/tail.res" "$tmp/resume.res"
+then echo "ok    resume"
+else echo "FAIL  resume"; failed=1
+fi
+
+# The same below a path, which the checkpoint must resume partway along.
+# The call totals must agree too.
+run path "path 10"
+run pathckpt "path 10" "checkpoint $tmp/pathckpt 1"
+run pathresume "path 10" "resume $tmp/pathckpt"
+sed -n '/^computecellorbackup calls: 1 000000/,$p' "$tmp/path.out" \
+  >"$tmp/pathtail.out"
+results "$tmp/pathtail.out" >"$tmp/pathtail.res"
+results "$tmp/pathresume.out" >"$tmp/pathresume.res"
+calls() { grep '^computecellorbackup calls' "$1" | tail -1; }
+if grep -q '^Resuming' "$tmp/pathresume.out" &&
+   cmp -s "$tmp/pathtail.res" "$tmp/pathresume.res" &&
+   [ "$(calls "$tmp/path.out")" = "$(calls "$tmp/pathresume.out")" ]
+then echo "ok    path resume"
+else echo "FAIL  path resume"; failed=1
+fi
+
+run lookahead lookahead
+check lookahead "$tmp/lookahead.out"
+
+run nogoods nogoods
+check nogoods "$tmp/nogoods.out"
+
+run canonhash canonhash
+results "$tmp/canonhash.out" >"$tmp/canonhash.res"
+if [ -s "$tmp/canonhash.res" ] &&
+   [ -z "$(comm -13 "$tmp/default.res" "$tmp/canonhash.res")" ]
+then echo "ok    canonhash ($(wc -l <"$tmp/canonhash.res") results)"
+else echo "FAIL  canonhash"; failed=1
+fi
+
+exit $failed